@@ -7,7 +7,8 @@
  **/
 
 /************************************** Includes *************************************************/
-#include <stdio.h>      // For (printf, getchar)
+#define _GNU_SOURCE     // For (posix_openpt, ptsname, cfmakeraw, splice)
+#include <stdio.h>      // For (printf)
 #include <stdlib.h>     // For (exit, malloc)
 #include <unistd.h>     // For (read, write, sleep)
 #include <fcntl.h>      // For (open with O_RDWR flag)
@@ -17,6 +18,27 @@
 #include <pthread.h>    // For (pthread_create, pthread_mutex)
 #include <signal.h>     // For (SIGINT)
 #include <sys/stat.h>   // For (S_IRUSR, S_IWUSR)
+#include <time.h>       // For (clock_gettime)
+#include <poll.h>       // For (poll)
+#include <sys/ioctl.h>  // For (ioctl TIOCOUTQ)
+#include <sys/socket.h> // For (socket, accept4, setsockopt)
+#include <sys/eventfd.h>// For (eventfd)
+#include <sys/signalfd.h>// For (signalfd)
+#include <netinet/in.h> // For (sockaddr_in)
+#include <netinet/tcp.h>// For (TCP_NODELAY)
+#include <arpa/inet.h>  // For (inet_ntop)
+#include <regex.h>      // For (regcomp, regexec)
+#include <sys/mman.h>   // For (mmap)
+#include <dirent.h>     // For (opendir, readdir) used by tab completion
+#include <stdarg.h>     // For (va_list) of the hotplug messages
+#include <limits.h>     // For (PATH_MAX)
+#include <sys/un.h>     // For (sockaddr_un) of the simulated uevent source
+#include <linux/netlink.h> // For (NETLINK_KOBJECT_UEVENT)
+#include <linux/serial.h>  // For (serial_icounter_struct of TIOCGICOUNT, ASYNC_LOW_LATENCY)
+#include <sched.h>      // For (SCHED_FIFO, cpu_set_t) of the real time reader
+#if defined(__x86_64__)
+#include <immintrin.h>  // For (SSSE3 shuffle used by the trigger prefilter)
+#endif
 
 /*************************************** Define Types ********************************************/
 typedef signed char StdReturn;
@@ -28,406 +50,7794 @@ typedef signed char StdReturn;
 
 #define OUT_FLAG_SHELL  0
 #define OUT_FLAG_DEST   1  
+#define OUT_FLAG_RESUME 2       // received data goes to a resumable destination (R>>)
 
 /*************************************** Defines *************************************************/
 #define BUF_SIZE 256    // buffer size for reading input from UART
 
+#define CTL_SOF         0x01        // start of an in-band control frame (resume negotiation)
+#define CTL_EOF         0x04        // end of an in-band control frame
+#define CTL_MAX         64          // max length of a control frame body
+#define CKPT_BLOCK      4096        // bytes between two checkpoints of a resumable transfer
+#define CKPT_SUFFIX     ".ckpt"     // sidecar file next to the received file
+#define RESUME_TIMEOUT  3           // seconds the sender waits for the receiver resume offer
+#define MUX_SOF         0x7E        // first byte of every multiplexed frame
+#define MUX_CHANNELS    3           // console, log, bulk
+#define MUX_PAYLOAD     64          // max payload of one frame, bounds how long a bulk frame holds the line
+#define MUX_HDR         3           // SOF + channel + length
+#define MUX_TXQ_LIMIT   (2 * (MUX_PAYLOAD + MUX_HDR + 1))  // driver queue allowed before low priority waits
+#define TX_SLICE        64          // bulk bytes written per scheduling round (one slice time on the wire)
+#define TX_LINES        16          // interactive messages that may wait for the scheduler
+#define NET_CLIENTS     8           // TCP clients bridged to the UART at the same time
+#define NET_BUF         65536       // per client buffer of received UART data not yet sent
+#define NET_SOCKBUF     (256 * 1024) // kernel socket buffers for bulk throughput
+#define NET_TXQ_LIMIT   1024        // UART driver queue above which client data is left in the socket
+
+#define TELNET_IAC      255         // telnet "interpret as command"
+#define TELNET_DONT     254
+#define TELNET_DO       253
+#define TELNET_WONT     252
+#define TELNET_WILL     251
+#define TELNET_SB       250         // subnegotiation begin
+#define TELNET_SE       240         // subnegotiation end
+#define TELNET_BINARY   0
+#define TELNET_SGA      3           // suppress go ahead
+#define TELNET_COMPORT  44          // RFC 2217 com port control option
+#define RX_SLAB_SIZE    1024        // max bytes of one read from the UART, one slab each
+#define RX_RING_SLOTS   64          // published slabs kept for the subscribers
+#define RX_SUBSCRIBERS  8           // consumers of the received data at the same time
+#define RX_POLICY_BLOCK 0           // slow subscriber holds back the reader (backpressure)
+#define RX_POLICY_DROP  1           // slow subscriber skips the slabs it missed
+#define RX_FROM_HEAD    (~0ULL)     // new subscriber starts with the next published slab
+#define RX_POOL_CHUNK   64          // slabs carved from one heap allocation when the pool is empty
+#define RX_POOL_BATCH   16          // slabs moved at once between a thread cache and the shared pool
+#define PIPE_CHUNK      65536       // bytes moved from stdin to the UART per call in --pipe mode
+#define SCRIPT_STEPS    256         // statements of an automation script
+#define SCRIPT_PATTERNS 32          // patterns of one expect statement
+#define SCRIPT_RX_BUF   65536       // received bytes kept until an expect scans them
+#define SCRIPT_OP_SEND      0       // send "text"
+#define SCRIPT_OP_EXPECT    1       // expect "pattern" [label] ... [timeout label]
+#define SCRIPT_OP_TIMEOUT   2       // timeout <ms> for the following expects
+#define SCRIPT_OP_GOTO      3       // goto <label>
+#define SCRIPT_OP_SLEEP     4       // sleep <ms>
+#define SCRIPT_OP_EXIT      5       // exit <code>
+#define SCRIPT_OP_RPC       6       // rpc "command", sent through the RPC layer without waiting
+#define SCRIPT_OP_RPC_WAIT  7       // rpc-wait [label]: wait for the answers, label when one failed
+#define TRIGGERS_MAX    1024        // patterns of the trigger engine
+#define TRIGGER_LINE    1024        // longest line kept as context for actions and regexes
+#define TRIGGER_HIGHLIGHT   0       // print the line highlighted
+#define TRIGGER_MARK        1       // print a timestamped mark
+#define TRIGGER_CAPTURE     2       // start capturing received data to a file (like R+)
+#define TRIGGER_RUN         3       // run a shell command (at most once per second)
+#define LINE_MAX_LEN    1024        // longest received line shown as one line, longer ones are split
+#define SCROLL_DEFAULT_MB 256       // scrollback kept in memory unless --scrollback says otherwise
+#define SCROLL_AVG_LINE 64          // bytes per line the line index is sized for
+#define SCROLL_RX       'R'         // line received from the UART
+#define SCROLL_TX       'T'         // line sent to the UART
+#define SCROLL_CONTEXT  2           // lines shown around the match of search
+#define EDIT_KEY_UP     0x100       // keys decoded from escape sequences
+#define EDIT_KEY_DOWN   0x101
+#define EDIT_KEY_RIGHT  0x102
+#define EDIT_KEY_LEFT   0x103
+#define EDIT_KEY_HOME   0x104
+#define EDIT_KEY_END    0x105
+#define EDIT_KEY_DELETE 0x106
+#define EDIT_KEY_WORD_LEFT  0x107
+#define EDIT_KEY_WORD_RIGHT 0x108
+#define EDIT_KEY_WORD_RUBOUT 0x109
+#define EDIT_KEY_PASTE  0x10A       // start of a bracketed paste
+#define STDIN_CHUNK     4096        // bytes taken from the terminal by one read
+#define ESC_WAIT_MS     50          // an ESC not followed by another byte within this time is a key of its own
+#define PASTE_MAX       65536       // pasted bytes handled as one block
+#define PASTE_END       "\033[201~" // end of a bracketed paste
+#define INPUT_MAX       (1 << 20)   // longest input line unless --max-line says otherwise
+#define PROMPT          "Enter text to send: "
+#define PROMPT_LEN      20          // columns taken by PROMPT
+#define HISTORY_MAX     500         // lines kept by the up/down history
+#define HISTORY_FILE    ".uart_shell_history"   // history file in $HOME
+#define COMPLETE_MAX    64          // candidates collected by one tab completion
+#define CHAR_ESCAPE     0x1D        // Ctrl+] leaves character mode
+#define RESUME_STALL    1000        // milliseconds of silence after which a receiving transfer is abandoned
+#define SHUTDOWN_DRAIN_MS 2000      // pending data is delivered for at most this long on exit (--drain)
+#define CONFIG_FILE     ".uart_shell.conf"      // configuration file in $HOME unless --config says otherwise
+#define CONFIG_DEFAULT  "default"   // section applied before the selected profile
+#define FLOW_NONE       0           // no flow control (--flow)
+#define FLOW_RTSCTS     1           // hardware flow control on RTS/CTS
+#define FLOW_XONXOFF    2           // software flow control
+#define CAPTURE_KEEP    5           // rotated capture files kept unless --capture-keep says otherwise
+#define SYS_TTY         "/sys/class/tty"        // every tty of the system, with a link to its device
+#define USB_SPEC        "usb:"      // --device usb:VID:PID[:serial] is looked up in SYS_TTY
+#define HOTPLUG_RETRY_MS 200        // a lost port is also tried this often (missed uevent, udev permissions)
+#define UEVENT_BUF      8192        // one uevent message
+#define AUTOBAUD_MS     300         // sampling time per candidate rate unless --autobaud-ms says otherwise
+#define AUTOBAUD_SAMPLE 256         // bytes sampled per candidate rate at most
+#define AUTOBAUD_CONFIDENT 32       // clean text bytes that lock a rate without trying the others
+#define AUTOBAUD_MIN_SCORE 60       // a best score below this is no readable text at any rate
+#define HEALTH_POLL_MS  1000        // interval of the driver error counters and the receive rate
+#define MODEM_INPUTS    (TIOCM_CTS | TIOCM_DSR | TIOCM_RNG | TIOCM_CD)   // lines watched with TIOCMIWAIT
+#define MODEM_SPIN_US   200         // the end of a DTR/RTS pulse is waited for by spinning this long
+#define LATENCY_TIMER_MS 1          // FTDI latency timer with --low-latency (the driver default is 16)
+#define BENCH_COUNT     100         // probes of a bench command unless it says otherwise
+#define BENCH_MAX       10000       // probes of a bench command at most
+#define BENCH_TIMEOUT_MS 1000       // a probe that did not come back within this is counted as lost
+#define BENCH_BUCKETS   10          // histogram of a bench, bucket limits in bench_limits
+#define BUSY_SPIN_US    10000       // without data the busy reader spins this long, then yields between reads
+#define BUSY_WINDOW_MS  100         // the CPU budget of the busy reader is kept per window of this length
+#define RPC_DEPTH_MAX   64          // outstanding RPC requests at most (--rpc-depth)
+#define RPC_ENDS        8           // response terminators at most (--rpc-end)
+#define RPC_KEYS        64          // commands with their own latency histogram, the rest share one
+#define RPC_CLIENTS     8           // connections of the RPC socket at the same time
+#define RPC_LINE        1024        // command or response line at most
+#define RPC_RESPONSE    4096        // response lines kept per request
+#define RPC_TIMEOUT_MS  5000        // a request without a terminator after this fails unless --rpc-timeout says otherwise
+#define RPC_OWNER_NONE   -1         // answer not wanted any more (connection closed)
+#define RPC_OWNER_SHELL  -2         // rpc <command> typed at the prompt
+#define RPC_OWNER_SCRIPT -3         // rpc statement of the --script
+#define RPC_OK          0           // the first terminator was received
+#define RPC_ERROR       1           // another terminator was received
+#define RPC_TIMEOUT     2           // no terminator in time
+
 /************************************** Global Vars **********************************************/
-char user_input[BUF_SIZE];                  // Buffer to store user input
+char *uart_device = NULL;                   // serial port (first argument, --device or the profile)
+char *uart_baud_arg = NULL;                 // baudrate as given (second argument, --baud or the profile)
+char uart_framing[4] = "8N1";               // data bits, parity and stop bits (--framing)
+int uart_flow = FLOW_NONE;                  // flow control (--flow)
+char *user_input = NULL;                    // Buffer to store user input, grows with the line
+unsigned int user_input_size = 0;           // bytes allocated for user_input
+unsigned int input_max = INPUT_MAX;         // longest line accepted (--max-line)
+pthread_mutex_t prompt_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // held while user_input changes, redraws wait
 unsigned int user_input_counter = 0;        // Counter for the number of characters entered by the user
-int uart_fd, dest_fd = -1,source_fd = -1;   // File descriptor for UART communication, received file
-char OUT_FLAG = OUT_FLAG_SHELL;             // received direction flag
+unsigned int edit_cursor = 0;               // position of the terminal cursor in user_input
+unsigned int edit_window = 0;               // first byte of user_input on the terminal (long lines)
+int uart_fd, source_fd = -1;                // File descriptor for UART communication, transmitted file
 
 pthread_mutex_t uart_lock;              // Mutex lock to protect UART access across threads
 pthread_t read_tid, write_tid;          // Threads for reading and writing UART data
 
+// resumable transfer state, receiver side (R>>file)
+struct resume_rx
+{
+    int ckpt_fd;                        // sidecar checkpoint file descriptor
+    int receiving;                      // 1 while data bytes of a transfer are arriving
+    int verifying;                      // 1 once all bytes arrived, until the RE frame of the sender
+    unsigned long long offset;          // bytes of the file received so far
+    unsigned long long total;           // size of the file announced by the sender
+    unsigned long long hash;            // rolling hash of the first (offset) bytes
+    unsigned long long ckpt_offset;     // offset of the last checkpoint written
+    unsigned long long ckpt_hash;       // hash of the last checkpoint written
+    long long last_rx;                  // monotonic millisecond of the last received data byte
+    char ckpt_path[BUF_SIZE + 8];       // path of the sidecar checkpoint file
+};
+
+// destination of the received data selected by R> / R>> (the shell view by default). a sink
+// never changes once published: write_thread builds a new one and swaps the pointer, the shell
+// subscriber (the only reader) keeps port.epoch odd while it delivers, and the old sink is
+// closed and freed once the delivery that may still use it is over. no lock on the data path
+struct rx_sink
+{
+    char kind;                          // OUT_FLAG_SHELL, OUT_FLAG_DEST or OUT_FLAG_RESUME
+    int fd;                             // destination file (-1 for the shell view)
+    char name[BUF_SIZE];                // destination file name, shown in stats
+    struct resume_rx resume;            // transfer state of a resumable destination
+};
+struct port_context
+{
+    struct rx_sink *sink;               // current sink, swapped atomically
+    unsigned long long epoch;           // odd while the reader holds a sink
+    unsigned long long switches;        // sinks replaced so far
+} port;
+
+// multiplexed virtual channels (--mux), index is the priority (0 = highest)
+struct mux_channel
+{
+    const char *name;                   // channel name shown to the user
+    int master_fd;                      // pty master the mux reads/writes
+    int slave_fd;                       // pty slave kept open so the master never hangs up
+    unsigned long long tx_frames;       // frames sent over the UART
+    unsigned long long rx_bytes;        // payload bytes delivered to the pty
+    unsigned long long rx_drops;        // payload bytes dropped because nobody reads the pty
+} mux[MUX_CHANNELS] = { {"console", -1, -1}, {"log", -1, -1}, {"bulk", -1, -1} };
+int mux_mode = 0;                       // 1 when started with --mux
+pthread_t mux_tid;                      // thread sending local channel data as frames
+
+// receive side frame parser of the multiplexer
+struct mux_parser
+{
+    int state;                          // 0 hunt SOF, 1 channel, 2 length, 3 payload, 4 crc
+    int channel;                        // channel of the frame being parsed
+    int length;                         // payload length of the frame being parsed
+    int got;                            // payload bytes collected so far
+    unsigned long long crc_errors;      // frames dropped on a bad checksum
+    char payload[MUX_PAYLOAD];          // payload being collected
+} mux_rx;
+
+// TX scheduler: interactive lines always go before the next slice of the bulk transfer
+struct tx_line
+{
+    char data[BUF_SIZE];                // line to send
+    int len;                            // length of the line
+    long long queued_us;                // monotonic time the line was queued
+};
+struct tx_scheduler
+{
+    pthread_mutex_t lock;               // protects the queues and the counters
+    pthread_cond_t wake;                // signalled when work is queued
+    pthread_cond_t room;                // signalled when a line left the queue or a write/T<< ended
+    struct tx_line lines[TX_LINES];     // interactive class, FIFO ring
+    int line_head, line_count;          // ring position and fill
+    int sending;                        // 1 while a line taken from the ring is being written
+    int exclusive;                      // 1 while a T<< negotiates or sends its data, lines are held
+    int direct;                         // writers bypassing the queue (RPC) in the middle of a write
+    int bulk_fd;                        // bulk class: file being transmitted (-1 when idle)
+    char bulk_name[BUF_SIZE];           // name of that file for the progress messages
+    unsigned long long bulk_sent;       // bytes of the file already sent
+    unsigned long long bulk_total;      // size of the file
+    unsigned long long bulk_hash;       // T<<: hash of the bytes up to bulk_sent, sent in the RE frame
+    unsigned long long lines_sent;      // stats: interactive messages sent
+    long long latency_sum_us;           // stats: sum of queue-to-driver latencies
+    long long latency_max_us;           // stats: worst queue-to-driver latency
+    int ahead_max;                      // stats: worst bytes already queued in the driver ahead of a line
+    unsigned long long bulk_bytes;      // stats: bulk bytes sent
+    unsigned long long bulk_slices;     // stats: bulk slices sent
+} tx = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, .bulk_fd = -1 };
+pthread_t tx_tid;                       // thread that owns UART writes in shell mode
+int uart_baud = 0;                      // line speed in bits per second
+
+// network bridge (--tcp / --rfc2217): one UART shared by several TCP clients
+struct net_client
+{
+    int fd;                             // client socket (-1 when the slot is free)
+    int telnet_state;                   // 0 data, 1 IAC, 2 option verb, 3 subnegotiation, 4 IAC in subnegotiation
+    unsigned char verb;                 // WILL/WONT/DO/DONT waiting for its option byte
+    unsigned char sb[16];               // subnegotiation being collected
+    int sb_len;                         // bytes collected in sb
+    unsigned char acked[2][32];         // options already answered (0 = WILL/WONT, 1 = DO/DONT), bitmap
+    char out[NET_BUF];                  // received UART data waiting for the socket
+    int out_len;                        // bytes waiting in out
+    unsigned long long drops;           // bytes dropped because the client did not keep up
+};
+struct net_bridge
+{
+    int port;                           // listening TCP port
+    int rfc2217;                        // 1 for telnet/RFC 2217 clients, 0 for raw
+    int listen_fd;                      // listening socket
+    int wake_fd;                        // eventfd raised when UART data was queued for the clients
+    pthread_mutex_t lock;               // protects the client output buffers
+    struct net_client clients[NET_CLIENTS];
+} net = { 0, 0, -1, -1, PTHREAD_MUTEX_INITIALIZER };
+int net_mode = 0;                       // 1 when started with --tcp or --rfc2217
+pthread_t net_tid;                      // thread running the socket event loop
+
+// broadcast of received data: read_uart publishes reference counted slabs into a ring,
+// every subscriber reads them with its own cursor, nobody copies the data
+struct rx_slab
+{
+    struct rx_slab *next;               // free list link while the slab is in a pool
+    int refs;                           // ring reference + subscribers processing it
+    int len;                            // bytes received
+    long long rx_us;                    // monotonic time the read returned
+    int event;                          // 1 for a modem line event line, only captures get it
+    char data[RX_SLAB_SIZE + 1];        // received bytes, always null terminated
+};
+struct rx_subscriber
+{
+    int used;                           // slot in use
+    int stop;                           // set to end the subscriber thread
+    int policy;                         // RX_POLICY_BLOCK or RX_POLICY_DROP
+    char name[BUF_SIZE];                // shown in stats, capture file name for R+
+    int fd;                             // capture file (-1 for other subscribers)
+    unsigned long long cursor;          // sequence of the next slab to read
+    unsigned long long bytes;           // bytes delivered
+    unsigned long long drops;           // slabs skipped because the subscriber was too slow
+    void (*deliver)(struct rx_subscriber *sub, const char *data, int len);
+    void (*idle)(struct rx_subscriber *sub);  // optional, called once after idle_ms without data
+    int idle_ms;                        // quiet time before idle() is called
+    int idle_armed;                     // data was delivered since the last idle() call
+    long long slab_us;                  // receive time of the slab being delivered
+    int busy;                           // 1 while deliver() or idle() runs outside the lock
+    unsigned long long file_bytes;      // bytes in the current capture file, for --capture-max
+    pthread_t tid;                      // thread running deliver()
+};
+struct rx_ring
+{
+    pthread_mutex_t lock;               // protects head, slots and cursors
+    pthread_cond_t more;                // signalled when a slab is published
+    pthread_cond_t room;                // signalled when a blocking subscriber advanced
+    unsigned long long head;            // sequence of the next slab to publish
+    struct rx_slab *slots[RX_RING_SLOTS];
+    struct rx_subscriber subs[RX_SUBSCRIBERS];
+} rx = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+int rx_capture_policy = RX_POLICY_BLOCK; // policy of R+file captures (--rx-policy)
+char *capture_file = NULL;              // capture started at startup (--capture)
+unsigned long long capture_max = 0;     // capture files are rotated at this size, 0 = never (--capture-max <MiB>)
+int capture_keep = CAPTURE_KEEP;        // rotated files kept as file.1 .. file.N (--capture-keep)
+
+// slab recycling: slabs are never returned to the heap. each thread keeps the slabs it
+// released in its own cache and trades them in batches with the shared pool, so the
+// reader and the subscribers touch the pool lock once per RX_POOL_BATCH slabs
+struct rx_slab_pool
+{
+    pthread_mutex_t lock;               // protects the shared free list and counters
+    struct rx_slab *free;               // shared free list
+    int free_count;                     // slabs in the shared free list
+    unsigned long long chunks;          // heap allocations made (RX_POOL_CHUNK slabs each)
+    unsigned long long refills;         // batches handed to a thread cache
+    unsigned long long returns;         // batches given back by a thread cache
+} rx_pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+__thread struct rx_slab *rx_cache = NULL; // slabs cached by this thread
+__thread int rx_cache_count = 0;          // slabs in rx_cache
+
+// headless streaming (--pipe): stdin -> UART, UART -> stdout, no prompt and no decoration
+int pipe_mode = 0;                      // 1 when started with --pipe
+int pipe_idle_ms = 1000;                // quiet time on the UART before exiting after stdin EOF
+long long pipe_last_rx = 0;             // monotonic millisecond of the last received byte
+pthread_t pipe_tid;                     // thread moving stdin to the UART
+
+// multi-pattern matcher: Aho-Corasick automaton compiled to a full transition table,
+// one table lookup per received byte whatever the number of patterns
+struct ac_automaton
+{
+    int states;                         // number of states, 0 is the root
+    int *next;                          // next[state * 256 + byte]
+    int *match;                         // pattern ending in that state (its own, else a suffix one), -1 if none
+    int *own;                           // pattern ending exactly in that state, -1 if none
+    int *dict;                          // nearest state on the failure chain with an own pattern, -1 if none
+    int *same;                          // per pattern: next pattern equal to it (ends in the same state), -1 if none
+};
+
+// expect-style automation (--script)
+struct script_step
+{
+    int op;                             // SCRIPT_OP_*
+    int line;                           // line in the script file, for messages
+    char text[BUF_SIZE];                // send: bytes to send
+    int text_len;                       // send: number of bytes
+    int value;                          // timeout/sleep/exit: number, goto: target step
+    int patterns;                       // expect: number of patterns
+    char *pattern[SCRIPT_PATTERNS];     // expect: patterns, for messages
+    int target[SCRIPT_PATTERNS];        // expect: step to continue with per pattern (-1 = next)
+    int timeout_target;                 // expect: step to continue with on timeout (-1 = fail)
+    char label[SCRIPT_PATTERNS + 1][32];// unresolved labels while loading
+    struct ac_automaton ac;             // expect: compiled patterns
+};
+struct script_engine
+{
+    struct script_step steps[SCRIPT_STEPS];
+    int count;                          // statements loaded
+    char labels[SCRIPT_STEPS][32];      // label names
+    int label_step[SCRIPT_STEPS];       // step each label points to
+    int label_count;                    // labels defined
+    pthread_mutex_t lock;               // protects the received bytes below
+    pthread_cond_t more;                // signalled when bytes were received
+    char rx[SCRIPT_RX_BUF];             // received bytes not yet scanned by an expect
+    unsigned long long rx_head;         // bytes received so far
+    unsigned long long rx_tail;         // bytes scanned so far
+    unsigned long long rx_drops;        // bytes lost because nobody expected for too long
+} script = { .lock = PTHREAD_MUTEX_INITIALIZER, .more = PTHREAD_COND_INITIALIZER };
+char *script_file = NULL;               // script given with --script
+
+// trigger engine (--triggers): literals and regexes watched on the received stream
+struct trigger
+{
+    int action;                         // TRIGGER_*
+    int is_regex;                       // 1 when pattern is a POSIX extended regex
+    char *pattern;                      // pattern as written in the file
+    int length;                         // bytes in pattern
+    char *argument;                     // file of capture, command of run
+    regex_t regex;                      // compiled regex
+    int literal;                        // regex: 1 when a required literal gates regexec
+    int pending;                        // regex: its literal was seen on the current line, highlight: it matched
+    unsigned long long hits;            // times fired
+    long long last_ms;                  // monotonic time of the last hit
+};
+struct trigger_engine
+{
+    struct trigger list[TRIGGERS_MAX];
+    int count;                          // triggers loaded
+    struct ac_automaton ac;             // all literals, regex required literals included
+    int *owner;                         // trigger of every automaton pattern
+    int state;                          // automaton state carried across reads
+    unsigned char start[32];            // bitmap of bytes that can leave the root state (and '\n')
+    unsigned char lo_nibble[16];        // shufti tables of the same set for the SSSE3 prefilter
+    unsigned char hi_nibble[16];
+    int have_ssse3;                     // CPU supports the SSSE3 prefilter
+    char line[TRIGGER_LINE + 1];        // current line
+    int line_len;                       // bytes in line
+    struct rx_subscriber *sub;          // our ring subscriber, a capture continues from its cursor
+    const char *rest;                   // bytes of the current slab after the one being matched
+    int rest_len;                       // number of those bytes
+    unsigned long long bytes;           // bytes scanned
+    unsigned long long skipped;         // bytes skipped by the prefilter
+    int ready;                          // 0 while compiling in the background, 1 compiled, -1 failed
+    pthread_mutex_t lock;               // protects ready
+    pthread_cond_t compiled;            // signalled when ready changes
+} trig = { .lock = PTHREAD_MUTEX_INITIALIZER, .compiled = PTHREAD_COND_INITIALIZER };
+char *trigger_file = NULL;              // triggers given with --triggers
+
+// line assembly of the shell view: received text is shown line by line, each line stamped
+// with the arrival time of its first byte
+struct line_assembler
+{
+    char text[LINE_MAX_LEN + 1];        // line being assembled
+    int len;                            // bytes in text
+    long long first_us;                 // monotonic arrival time of the first byte
+    int idle_ms;                        // a partial line is shown after this quiet time (--line-idle)
+    int prompt_cleared;                 // the prompt was removed for the lines being printed
+} rx_line = { .idle_ms = 100 };
+long long start_us;                     // monotonic time at startup
+
+// startup timing: monotonic times of the startup steps, shown by stats
+struct startup_times
+{
+    long long main_us;                  // main() entered
+    long long options_us;               // configuration file and command line applied
+    long long open_us;                  // serial port open and configured
+    long long first_rx_us;              // first byte received
+    long long triggers_us;              // trigger automaton compiled
+} startup;
+struct timespec start_wall;             // wall clock time at startup
+
+// scrollback: every line received or sent, kept in a ring and searchable (search/grep).
+// lines never wrap around the end of the data ring, so each one is contiguous in memory
+struct scroll_line
+{
+    unsigned long long off;             // logical offset of the text in the data ring
+    long long us;                       // monotonic time of the first byte
+    int len;                            // text bytes, the newline after them not counted
+    char dir;                           // SCROLL_RX or SCROLL_TX
+};
+struct scrollback
+{
+    pthread_mutex_t lock;               // protects everything except the assembly fields
+    unsigned long long size;            // data ring bytes, 0 = disabled (--scrollback <MiB>)
+    char *data;                         // data ring, mapped on first use
+    unsigned long long head;            // logical offset of the next byte stored
+    struct scroll_line *lines;          // line index ring, mapped on first use
+    unsigned long long slots;           // entries of the line index
+    unsigned long long first;           // sequence of the oldest line kept
+    unsigned long long count;           // sequence of the next line
+    char line[LINE_MAX_LEN];            // received line being assembled (subscriber thread only)
+    int line_len;                       // bytes in line
+    long long line_us;                  // monotonic arrival time of its first byte
+} scroll = { .lock = PTHREAD_MUTEX_INITIALIZER, .size = (unsigned long long)SCROLL_DEFAULT_MB << 20 };
+
+// command history of the line editor, also kept in $HOME/HISTORY_FILE
+struct line_history
+{
+    char *lines[HISTORY_MAX];           // entered lines, ring
+    int count;                          // lines entered so far, line i is at lines[i % HISTORY_MAX]
+    int browse;                         // line shown while browsing with up/down, count = none
+    char *draft;                        // line being typed before browsing started
+    int fd;                             // history file opened for appending
+} history = { .fd = -1 };
+
+// keyboard input: read in chunks, a paste arrives as one chunk (or between bracketed paste marks)
+struct stdin_buffer
+{
+    char data[STDIN_CHUNK];             // bytes of the last read
+    int len;                            // bytes in data
+    int pos;                            // next byte to use
+} input;
+int paste_delay_ms = 0;                 // pause after each pasted line (--paste-delay), 0 = one write
+
+// character mode (char command): keystrokes go to the UART as they are typed and received
+// bytes go to the terminal as they are, for remote shells, key menus and editors on the target
+struct char_passthrough
+{
+    int active;                         // 1 while in character mode
+    unsigned long long keys;            // stdin reads forwarded (a key or one escape sequence)
+    unsigned long long bytes;           // bytes forwarded
+    long long latency_sum_us;           // key read to bytes transmitted by the UART, summed
+    long long latency_max_us;           // worst key to wire latency
+} charmode;
+
+// shutdown: SIGINT/SIGTERM are read from a signalfd by the shutdown thread and threads ask for
+// it through an eventfd, so nothing runs in signal context and no thread is cancelled mid-write
+struct shutdown_ctl
+{
+    int signal_fd;                      // signalfd of SIGINT and SIGTERM
+    int wake_fd;                        // eventfd raised by shutdown_request()
+    int drain_ms;                       // deadline for delivering pending data
+    int stopping;                       // 1 once shutdown began: no new reads, no new bulk slices, no prompt
+    int signo;                          // signal that ended the program, 0 for a shutdown request
+    int term_saved;                     // 1 when term holds the terminal settings at startup
+    struct termios term;                // terminal settings restored on exit
+} shut = { -1, -1, SHUTDOWN_DRAIN_MS };
+pthread_t shutdown_tid;                 // thread waiting for a signal or a shutdown request
+
+// hotplug: an unplugged port is opened again when it comes back, found by kernel uevents
+// (or a simulated source, --uevents). uart_fd keeps its number the whole time: /dev/null is
+// put in its place while the port is away and the new port replaces it with dup2()
+struct hotplug_ctl
+{
+    char spec[BUF_SIZE];                // device as given, a path or usb:VID:PID[:serial]
+    char path[PATH_MAX];                // device node currently (or last) open
+    speed_t speed;                      // baudrate used when the settings could not be saved
+    struct termios term;                // settings when the port was lost, RFC 2217 changes included
+    int term_saved;                     // 1 when term holds them
+    int event_fd;                       // netlink uevent socket or the --uevents datagram socket
+    char *sim_path;                     // --uevents: socket receiving simulated uevents
+    int lost;                           // 1 while the port is away
+    unsigned long long generation;      // opens of the port, an error of an older one is ignored
+    unsigned long long losses;          // times the port was lost
+    unsigned long long reopens;         // times it was opened again
+    long long reopen_max_us;            // worst time from the add uevent to the port being open
+    pthread_mutex_t lock;               // protects the fields above
+    pthread_cond_t back;                // signalled when the port was opened again
+} hotplug = { .event_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .back = PTHREAD_COND_INITIALIZER };
+pthread_t hotplug_tid;                  // thread reading the uevents
+int list_ports = 0;                     // --list: show the serial ports and exit
+
+// autobaud (<baud_rate> auto): candidate rates are sampled with error marking and scored
+struct autobaud_ctl
+{
+    int budget_ms;                      // sampling time per candidate rate (--autobaud-ms)
+    char keep[AUTOBAUD_SAMPLE];         // text sampled at the chosen rate, published before the first read
+    int keep_len;                       // bytes in keep
+} autobaud = { .budget_ms = AUTOBAUD_MS };
+const int autobaud_order[] = { 115200, 9600, 57600, 38400, 19200 };  // most common consoles first
+
+// link health: bytes the line discipline marked (PARMRK) are removed from the received data and
+// counted, the driver counters (TIOCGICOUNT) tell overruns, framing and parity errors apart
+struct link_health
+{
+    int mark_state;                     // decoder across reads: 0, 1 after 0xFF, 2 after 0xFF 0x00
+    unsigned long long rx_bytes;        // bytes received, marks removed (reader thread only)
+    unsigned long long marked_errors;   // bytes received with a framing or parity error, dropped
+    unsigned long long marked_breaks;   // breaks received
+    int have_icount;                    // the driver answers TIOCGICOUNT
+    struct serial_icounter_struct last; // counters of the last poll
+    unsigned long long frame;           // driver counts since startup, over reopens
+    unsigned long long parity;
+    unsigned long long overrun;         // UART FIFO overruns: the driver read too late
+    unsigned long long buf_overrun;     // tty buffer overruns: we read too late
+    unsigned long long brk;
+    unsigned long long rate;            // bytes per second in the last interval
+    unsigned long long rate_peak;       // best interval so far
+    pthread_mutex_t lock;               // protects the driver counts and rates
+} health = { .lock = PTHREAD_MUTEX_INITIALIZER };
+pthread_t health_tid;                   // thread polling the counters
+
+// modem control lines: DTR/RTS are set or pulsed by the dtr/rts commands, changes of CTS, DSR,
+// RI and DCD are waited for with TIOCMIWAIT (no polling) and written into the capture files
+struct modem_monitor
+{
+    int supported;                      // 0 once the driver refused TIOCMIWAIT
+    int lines;                          // TIOCM_* bits after the last change
+    unsigned long long changes[4];      // changes per input line, order of modem_inputs
+    long long last_us;                  // monotonic time of the last change
+    pthread_mutex_t lock;               // protects the fields above
+} modem = { .supported = 1, .lock = PTHREAD_MUTEX_INITIALIZER };
+pthread_t modem_tid;                    // thread waiting for line changes
+
+// low latency (--low-latency): the driver hands received bytes over at once instead of collecting
+// them first (ASYNC_LOW_LATENCY, FTDI latency_timer). the reader can also run as a real time
+// thread pinned to one CPU (--rt-priority, --rx-cpu). the original port settings are restored at exit
+struct low_latency
+{
+    int enabled;                        // --low-latency
+    int rt_priority;                    // SCHED_FIFO priority of the reader, 0 = normal scheduling
+    int rx_cpu;                         // CPU the reader runs on, -1 = any
+    int saved;                          // 1 once the settings below were read from the first port
+    int serial_was;                     // ASYNC_LOW_LATENCY before, -1 when the driver has no TIOCGSERIAL
+    int timer_was;                      // latency_timer before in ms, -1 when the port has none
+    int serial_now;                     // ASYNC_LOW_LATENCY now
+    int timer_now;                      // latency_timer now
+    char reader[BUF_SIZE];              // what became of --rt-priority and --rx-cpu, for stats
+} lowlat = { .rx_cpu = -1, .serial_was = -1, .timer_was = -1, .timer_now = -1 };
+
+// bench [count]: probes are written straight to the UART and timed until they come back from an
+// echoing target or a loopback plug, the time is taken when the reader got them
+struct bench_ctl
+{
+    char token[32];                     // probe being waited for
+    int token_len;
+    int match;                          // bytes of the token matched so far
+    long long back_us;                  // receive time of the probe, 0 while it is out
+    long long min_us, p50_us, p90_us, p99_us, max_us;  // result of the last bench
+    int samples, lost;
+    int histogram[BENCH_BUCKETS];       // round trips below each of bench_limits
+    const char *reader;                 // how the reader waited during the last bench
+    pthread_mutex_t lock;               // protects the fields above
+    pthread_cond_t back;                // signalled when the probe came back
+} bench = { .lock = PTHREAD_MUTEX_INITIALIZER, .back = PTHREAD_COND_INITIALIZER };
+const int bench_limits[BENCH_BUCKETS] = { 20, 50, 100, 200, 500, 1000, 2000, 5000, 20000, INT_MAX };
+
+// busy poll reader (--busy-poll): read() returns at once (VMIN 0) and is called again and again, so
+// a byte is seen without the wakeup of a blocked thread. after BUSY_SPIN_US without data it yields
+// the CPU between reads, and within each BUSY_WINDOW_MS it spins at most for --busy-budget percent
+// of the time, then blocks in poll() for the rest of the window (data still wakes it at once)
+struct busy_reader
+{
+    int enabled;                        // --busy-poll
+    int budget;                         // percent of a CPU it may spin for (--busy-budget)
+    long long window_us;                // start of the current budget window
+    long long window_cpu_us;            // thread CPU time at the start of the window
+    long long last_check_us;            // last time the CPU time was read
+    unsigned long long reads;           // reads that returned data
+    unsigned long long empty;           // reads that returned nothing
+    unsigned long long yields;          // sched_yield() calls in the back off
+    unsigned long long throttled;       // windows in which the budget was used up
+    long long cpu_us;                   // CPU time used by the reader
+} busy = { .budget = 100 };
+
+// RPC layer (--rpc <socket>, rpc command, rpc statements of scripts): up to --rpc-depth commands are
+// on the wire at the same time, each answer is matched to its command, in order of sending or by
+// the tag sent in front of the command (--rpc-tag), and ends with a terminator line (--rpc-end)
+struct rpc_request
+{
+    int used;                           // slot in use
+    unsigned long long seq;             // order of sending, the tag number with --rpc-tag
+    int owner;                          // client slot or RPC_OWNER_*
+    unsigned long long number;          // number of the request on its connection
+    int key;                            // latency statistics, index in rpc.keys
+    char command[RPC_LINE];             // as given, without tag and end of line
+    long long sent_us;                  // monotonic time it was written, 0 while it waits for the UART
+    long long deadline_us;              // it fails with RPC_TIMEOUT after this
+    char response[RPC_RESPONSE];        // lines received for it, the terminator not included
+    int response_len;
+};
+struct rpc_key
+{
+    char name[32];                      // first word of the command (up to '=' or '?')
+    unsigned long long count, errors, timeouts;
+    long long min_us, max_us, sum_us;   // of the answered requests
+    int histogram[BENCH_BUCKETS];       // answered requests below each of bench_limits
+};
+struct rpc_client
+{
+    int fd;                             // -1 when the slot is free
+    char in[RPC_LINE];                  // commands read but not yet sent
+    int in_len;
+    unsigned long long requests;        // commands read, numbers the answers
+    int pending;                        // requests of this connection without an answer
+    int eof;                            // the client sent everything, it is closed after the last answer
+    int broken;                         // does not take its answers or speak the protocol, closed at once
+};
+struct rpc_ctl
+{
+    int started;                        // subscriber and thread running
+    int wanted;                         // a script uses rpc statements
+    char *socket_path;                  // --rpc: unix socket of the API, NULL for none
+    int depth;                          // requests on the wire at most (--rpc-depth)
+    int timeout_ms;                     // --rpc-timeout
+    char eol[16];                       // appended to every command (--rpc-eol)
+    int eol_len;
+    char ends[RPC_ENDS][32];            // terminator line starts, the first one means success
+    int end_count;
+    char *tag;                          // --rpc-tag prefix, NULL: answers come in order
+    struct rpc_request req[RPC_DEPTH_MAX];
+    int outstanding;                    // requests in req
+    unsigned long long next_seq;
+    char line[RPC_LINE];                // received line being assembled
+    int line_len;
+    struct rpc_key keys[RPC_KEYS];
+    int key_count;
+    int script_outstanding;             // requests of the script without an answer
+    int script_failed;                  // requests of the script that failed since the last rpc-wait
+    struct rpc_client clients[RPC_CLIENTS];
+    int listen_fd;                      // socket of the API, -1 for none
+    int wake_fd;                        // eventfd waking the thread when a request was answered
+    pthread_mutex_t lock;               // protects the fields above
+    pthread_cond_t room;                // signalled when a request was answered
+    unsigned long long tx_seq;          // request whose command goes on the wire next
+    pthread_mutex_t tx_lock;            // protects tx_seq, held while a command is written
+    pthread_cond_t tx_turn;             // signalled when a command was written
+} rpc = { .depth = 1, .timeout_ms = RPC_TIMEOUT_MS, .eol = "\r", .eol_len = 1,
+          .ends = { "OK", "ERROR" }, .end_count = 2, .listen_fd = -1, .wake_fd = -1,
+          .lock = PTHREAD_MUTEX_INITIALIZER, .room = PTHREAD_COND_INITIALIZER,
+          .tx_lock = PTHREAD_MUTEX_INITIALIZER, .tx_turn = PTHREAD_COND_INITIALIZER };
+pthread_t rpc_tid;                      // thread of the socket API and the timeouts
+const struct { int bit; const char *name; } modem_inputs[4] =
+{
+    { TIOCM_CTS, "CTS" }, { TIOCM_DSR, "DSR" }, { TIOCM_RNG, "RI" }, { TIOCM_CD, "DCD" },
+};
+
+// in-band control frame parser and reply slot (T<<file waits here for the receiver offer)
+char ctl_frame[CTL_MAX + 1];            // control frame being collected
+int ctl_frame_len = -1;                 // -1 when not inside a frame
+int ctl_awaiting_offer = 0;             // 1 while T<< waits for a resume offer
+char ctl_reply[CTL_MAX + 1];            // last resume offer received
+int ctl_reply_ready = 0;                // 1 when ctl_reply holds a fresh offer
+pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ctl_cond = PTHREAD_COND_INITIALIZER;
+
 /*************************************** Functions declaration ************************************/
+// Function to parse the command line (or one setting of the configuration file)
+StdReturn parse_options(int argc, char *argv[], int positional);
+// Function to apply the [default] section and the selected profile of the configuration file
+StdReturn config_load(const char *file, const char *profile, int required);
+// Function to check the options once the configuration file and the command line were applied
+StdReturn options_check(void);
 // Function to delete characters from the terminal (used for backspace functionality)
 StdReturn delete_chars(unsigned int number);
 // Function to set terminal input mode (canonical or raw) mode
 StdReturn set_input_mode(char mode);
 // Function to map baudrate string to baudrate constant
 speed_t get_baudrate(const char *baudrate_str);
+// Function to map a numeric baudrate to its constant (0 if unsupported)
+speed_t baud_to_speed(int baud);
+// Function to map a baudrate constant back to bits per second
+int speed_to_baud(speed_t speed);
 // Function to configure UART settings (baud rate, data bits, stop bits, and parity)
 int setup_uart(const char *device, speed_t baudrate); 
-// Function to write data to the UART device
+// Function to apply the termios settings of the options to an open port
+void uart_configure(int fd, speed_t baudrate);
+// Function to approximate log2(x) in 1/256 bits, for the entropy of a sample without libm
+int log2_q8(unsigned int x);
+// Function to sample the port at one rate, returns the score of the decoded text (0-100)
+int autobaud_sample(int fd, speed_t speed, char *out, int *out_len, int *confident);
+// Function to find the rate the target sends at, returns its constant or 0
+speed_t autobaud_detect(int fd);
+// Function to read one sysfs attribute, without the trailing newline
+StdReturn sysfs_read(const char *dir, const char *attr, char *out, int size);
+// Function to read the ids of the USB device a tty belongs to, E_NOK when it is no USB tty
+StdReturn tty_usb_ids(const char *name, char *vid, char *pid, char *serial, char *product);
+// Function to turn a device (path or usb:VID:PID[:serial]) into the node to open
+StdReturn tty_resolve(const char *spec, char *path, int size);
+// Function to list the serial ports with their USB ids (--list)
+int tty_list(void);
+// Function to print a port message above the prompt (or to stderr without the shell view)
+void port_notice(const char *tag, const char *format, ...);
+// Function to release a port that went away, writers see /dev/null until it is back
+void port_lost(unsigned long long generation);
+// Function to wait until a lost port was opened again
+void port_wait(void);
+// Function to open the port again and put it in place of /dev/null
+StdReturn port_reopen(long long event_us);
+// Function to open the uevent socket, netlink or the simulated source of --uevents
+StdReturn hotplug_open(void);
+// Function to watch the uevents and reopen the port when it comes back
+void* hotplug_thread(void* arg);
+// Function to remove the PARMRK marks from received bytes in place, returns the bytes left
+int link_unmark(char *data, int len);
+// Function to add the driver error counters since the last poll, returns 1 when one grew
+int link_icount_poll(void);
+// Function to poll the error counters and the receive rate, warning when errors appear
+void* health_thread(void* arg);
+// Function to read the driver count of transitions of one input line (index of modem_inputs)
+int modem_icount(const struct serial_icounter_struct *count, int input);
+// Function to wait for changes of the input lines and publish each one as a capture event
+void* modem_thread(void* arg);
+// Function to set, clear or pulse DTR or RTS (dtr/rts commands)
+void modem_command(int bit, const char *name, const char *arg);
+// Function to show the modem lines and their changes (modem command)
+void print_modem(void);
+// Function to write one sysfs attribute
+StdReturn sysfs_write(const char *dir, const char *attr, const char *value);
+// Function to make the driver of an open port hand over received bytes at once (--low-latency)
+void link_low_latency(int fd, const char *path);
+// Function to put the low latency settings of the port back as they were at startup
+void link_low_latency_restore(void);
+// Function to make the calling thread the real time reader (--rt-priority, --rx-cpu)
+void reader_realtime(void);
+// Function to look for the bench probe in the received data
+void rx_bench(struct rx_subscriber *sub, const char *data, int len);
+// Function to measure the round trip time of (count) probes (bench command)
+void bench_run(int count);
+// Function to keep the busy reader within its CPU budget, blocking for the rest of a window if needed
+void busy_throttle(long long now);
+// Function to turn \r \n \t \xHH escapes of an option into bytes, returns the length
+int rpc_unescape(const char *text, char *out, int size);
+// Function to start the RPC layer: response matching, timeouts and the socket API
+StdReturn rpc_start(void);
+// Function to send one command as a request, rpc.lock held (released during the write) and a slot free
+void rpc_submit(const char *command, int owner, unsigned long long number);
+// Function to send one command as a request, waiting until fewer than --rpc-depth are outstanding
+void rpc_call(const char *command, int owner);
+// Function to finish a request: statistics, answer to its owner, slot free again (rpc.lock held)
+void rpc_finish(struct rpc_request *req, const char *end, int status, long long us);
+// Function to give one received line to the request it belongs to
+void rpc_line(char *line, int len, long long us);
+// Function to cut the received data into lines for the RPC layer
+void rx_rpc(struct rx_subscriber *sub, const char *data, int len);
+// Function to wait for the answers to the requests of the script, returns how many failed
+int rpc_script_wait(void);
+// Function to print the requests and latency histograms per command (rpc.lock held)
+void rpc_report(FILE *out);
+// Function to print the requests and latency histograms per command (rpc command)
+void print_rpc(void);
+// Function to send the commands a connection sent while there is room for them (rpc.lock held, see rpc_submit)
+void rpc_client_lines(int slot);
+// Function to close a connection, its requests are still answered on the wire (rpc.lock held)
+void rpc_client_close(int slot);
+// Function to run the socket API and fail the requests that were not answered in time
+void* rpc_thread(void* arg);
+// Function to read from the UART by calling a read that does not block until data arrives (--busy-poll)
+int read_busy(char *buf, int size);
+// Function to write data to the UART device (queued as interactive traffic)
 int write_uart(const char *data);
-// Function to continuously read data from the UART and display it to the user
+// Function to write a binary buffer of known length to the UART device
+int write_uart_len(const char *data, int len);
+// Function to print the prompt again with any partial user input
+void redraw_prompt(void);
+// Function to remove the prompt and the typed text from the terminal, wrapped rows included
+void clear_prompt(void);
+// Function to read the monotonic clock in milliseconds
+long long monotonic_ms(void);
+// Function to read the monotonic clock in microseconds
+long long monotonic_us(void);
+// Function to update the rolling hash of a resumable transfer
+unsigned long long ckpt_hash(unsigned long long hash, const char *data, int len);
+// Function to hash the first (length) bytes of a file
+StdReturn ckpt_hash_prefix(int fd, unsigned long long length, unsigned long long *hash);
+// Function to store the checkpoint (offset + hash) of a resumable transfer
+StdReturn ckpt_save(struct rx_sink *sink);
+// Function to feed one received byte to the control frame parser (returns 1 if it is plain data)
+int ctl_feed(struct rx_sink *sink, char c);
+// Function to handle a complete control frame
+void ctl_dispatch(struct rx_sink *sink, const char *frame);
+// Function to open a resumable destination file and restore its last checkpoint (R>>file)
+StdReturn resume_receive_open(const char *file);
+// Function to consume received bytes while a resumable destination is active
+void resume_receive(struct rx_sink *sink, const char *buf, int len);
+// Function to create a sink for the shell view or a destination file
+struct rx_sink* rx_sink_new(char kind, int fd, const char *name);
+// Function to make (sink) the destination of received data, the old one is closed once unused
+void rx_sink_switch(struct rx_sink *sink);
+// Function to take the current sink, it stays valid until rx_sink_leave() (shell subscriber only)
+struct rx_sink* rx_sink_enter(void);
+// Function to tell writers the reader no longer holds a sink
+void rx_sink_leave(void);
+// Function to transmit a file resuming from the receiver last checkpoint (T<<file)
+StdReturn resume_transmit(const char *file);
+// Function to compute the CRC-8 (poly 0x07) of a multiplexed frame
+unsigned char mux_crc8(const unsigned char *data, int len);
+// Function to create one pty per virtual channel
+StdReturn mux_open(void);
+// Function to send one payload as a frame on a virtual channel
+int mux_send(int channel, const char *data, int len);
+// Function to split received bytes into frames and deliver them to the channel ptys
+void mux_demux(const char *buf, int len);
+// Function to forward local channel data to the UART, highest priority channel first
+void* mux_thread(void* arg);
+// Function to queue an interactive message, it goes out before the next bulk slice
+StdReturn tx_submit_line(const char *data, int len);
+// Function to queue one piece of at most BUF_SIZE bytes, waiting for room in the queue
+void tx_enqueue(const char *data, int len);
+// Function to hand a file to the scheduler as the bulk transfer, starting at (offset)
+StdReturn tx_submit_file(int fd, const char *name, unsigned long long offset, unsigned long long total);
+// Function to tell whether a T<< owns the UART, nothing may be written between its bytes then
+int tx_resume_running(void);
+// Function to start a write that bypasses the queue, waiting while a T<< owns the UART (returns 1 if it waited)
+int tx_direct_begin(void);
+// Function to end a write started with tx_direct_begin()
+void tx_direct_end(void);
+// Function to write queued data to the UART, interactive class first, bulk in slices
+void* tx_thread(void* arg);
+// Function to print the runtime statistics (stats command)
+void print_stats(void);
+// Function to open the TCP listener of the network bridge
+StdReturn net_open(void);
+// Function to queue received UART data for every connected client
+void net_broadcast(const char *buf, int len);
+// Function to append bytes to a client output buffer (telnet clients get 0xFF doubled)
+void net_queue(struct net_client *client, const unsigned char *data, int len);
+// Function to answer a telnet option request once
+void net_option(struct net_client *client, unsigned char verb, unsigned char option);
+// Function to strip telnet commands from client data, returns the bytes meant for the UART
+int net_from_client(struct net_client *client, unsigned char *buf, int len);
+// Function to execute an RFC 2217 com port command and send the answer
+void rfc2217_command(struct net_client *client, const unsigned char *sb, int len);
+// Function to run the socket event loop of the network bridge
+void* net_thread(void* arg);
+// Function to allocate an empty slab for one UART read
+struct rx_slab* rx_slab_alloc(void);
+// Function to drop one reference of a slab, recycling it with the last one
+void rx_slab_release(struct rx_slab *slab);
+// Function to give (count) slabs of the thread cache back to the shared pool
+void rx_cache_flush(int count);
+// Function to publish a filled slab to all subscribers
+void rx_publish(struct rx_slab *slab);
+// Function to add a consumer of the received data, it starts with the next published slab
+struct rx_subscriber* rx_subscribe(const char *name, int policy, int fd,
+                                   void (*deliver)(struct rx_subscriber *sub, const char *data, int len));
+// Function to add a consumer of the received data starting at slab sequence (from)
+struct rx_subscriber* rx_subscribe_from(const char *name, int policy, int fd,
+                                        void (*deliver)(struct rx_subscriber *sub, const char *data, int len),
+                                        unsigned long long from);
+// Function to stop the subscriber with that name
+StdReturn rx_unsubscribe(const char *name);
+// Function to feed one subscriber with the slabs published after its cursor
+void* rx_subscriber_thread(void* arg);
+// Function to show or save received data as selected by R> / R>> (the shell view)
+void rx_primary(struct rx_subscriber *sub, const char *data, int len);
+// Function to show the partial line of the shell view after the idle timeout
+void rx_primary_idle(struct rx_subscriber *sub);
+// Function to add received bytes to the line being assembled, printing completed lines
+void line_feed(const char *data, int len, long long rx_us);
+// Function to print the assembled line with its timestamps
+void line_emit(void);
+// Function to format a monotonic time as wall clock time and seconds since start
+void format_stamp(long long us, char *out, int size);
+// Function to store one line in the scrollback
+void scroll_add(char dir, const char *text, int len, long long us);
+// Function to split received data into scrollback lines
+void rx_scroll(struct rx_subscriber *sub, const char *data, int len);
+// Function to store the partial received line after the idle timeout
+void rx_scroll_idle(struct rx_subscriber *sub);
+// Function to find the scrollback line holding the byte at logical offset (off)
+unsigned long long scroll_find(unsigned long long off);
+// Function to print one scrollback line (scroll.lock held)
+void scroll_print(FILE *out, unsigned long long seq, int hit);
+// Function to search the scrollback, all matching lines (grep) or the latest one with context (search)
+void scroll_search(const char *pattern, int all);
+// Function to append received data to an additional capture file (R+file)
+void rx_capture(struct rx_subscriber *sub, const char *data, int len);
+// Function to start a new capture file once the current one reached --capture-max
+void capture_rotate(struct rx_subscriber *sub);
+// Function to deliver received data to the multiplexer channels
+void rx_mux(struct rx_subscriber *sub, const char *data, int len);
+// Function to deliver received data to the TCP clients
+void rx_net(struct rx_subscriber *sub, const char *data, int len);
+// Function to write received data unmodified to stdout (--pipe)
+void rx_pipe(struct rx_subscriber *sub, const char *data, int len);
+// Function to move stdin to the UART, with splice when the kernel allows it (--pipe)
+void* pipe_thread(void* arg);
+// Function to compile a set of patterns into an Aho-Corasick automaton
+StdReturn ac_compile(struct ac_automaton *ac, char **patterns, const int *lengths, int count);
+// Function to read one word or quoted string (with \r \n \t \xHH escapes) from a script line
+int script_token(char **cursor, char *out, int size, int *quoted);
+// Function to load and compile an automation script
+StdReturn script_load(const char *file);
+// Function to wait until one pattern of an expect matches, returns its index or -1 on timeout
+int script_expect(struct script_step *step, int timeout_ms);
+// Function to run the loaded script, returns the exit code
+int script_run(void);
+// Function to keep received data for the next expect of the script
+void rx_script(struct rx_subscriber *sub, const char *data, int len);
+// Function to find the longest literal every match of a regex must contain
+int regex_required_literal(const char *regex, char *out, int size);
+// Function to load the trigger file and compile its regexes, the automaton is built later by trigger_compile()
+StdReturn trigger_load(const char *file);
+// Function to compile all literals, regex required literals included, into one automaton
+StdReturn trigger_compile(void);
+// Function to compile the triggers in the background, so startup does not wait for a large list
+void* trigger_compile_thread(void* arg);
+// Function to find the first byte that may start a match (portable version)
+int trigger_skip(const unsigned char *data, int len);
+// Function to find the first byte that may start a match, 16 bytes per step
+int trigger_skip_ssse3(const unsigned char *data, int len);
+// Function to execute the action of a trigger that fired
+void trigger_fire(struct trigger *t, const char *line, int len);
+// Function to run the regexes and show the highlights of the line that just ended
+void trigger_end_line(void);
+// Function to scan received data for all triggers
+void rx_trigger(struct rx_subscriber *sub, const char *data, int len);
+// Function to list the triggers and their hits (triggers command)
+void print_triggers(void);
+// Function to continuously read data from the UART and publish it to the subscribers
 void* read_uart(void* arg);
+// Function to load the history file and open it for appending
+void history_load(void);
+// Function to remember an entered line
+void history_add(const char *line);
+// Function to make room for a line of (size) bytes, terminator included
+StdReturn input_reserve(unsigned int size);
+// Function to insert typed characters at the cursor
+void edit_insert(const char *text, int len);
+// Function to delete (count) characters starting at (from), the cursor ends at (from)
+void edit_delete(unsigned int from, unsigned int count);
+// Function to move the cursor within the line
+void edit_move(unsigned int to);
+// Function to replace the whole line (history browsing)
+void edit_replace(const char *text);
+// Function to complete the command or the file path before the cursor (tab)
+void edit_complete(void);
+// Function to take the next byte typed, reading a new chunk when needed
+int input_byte(void);
+// Function to handle a chunk of pasted text, returns 1 when it ends the line like Enter
+int edit_paste(const char *text, int len);
+// Function to send pasted lines in one write, or line by line with --paste-delay
+void paste_send(const char *text, int len);
+// Function to read one key, escape sequences are returned as EDIT_KEY_* codes
+int edit_key(void);
+// Function to edit a line until Enter is pressed on a non empty line
+StdReturn edit_line(void);
+// Function to pass keystrokes to the UART until the escape key (char command)
+void char_mode(void);
 // Function to continuously prompt the user for input and send it over UART
 void* write_thread(void* arg);
-// Function to clean up resources and exit the program gracefully
+// Function to ask the shutdown thread to end the program (stdin closed)
+void shutdown_request(void);
+// Function to wait for SIGINT/SIGTERM or a shutdown request, then clean up
+void* shutdown_thread(void* arg);
+// Function to name the first stage still holding data on its way out, NULL when all is delivered
+const char* shutdown_pending(void);
+// Function to deliver pending data until the drain deadline, sync the captures and exit
 void cleanup_and_exit();
-// Signal handler for SIGINT (Ctrl+C)kill-signal to cleanly exit
-void sigint_handler(int sig);
 
 /****************************************** Main program ********************************************/
 int main(int argc, char *argv[]) 
 {
-    if (argc != 3) // handle user fault 
+    char default_config[BUF_SIZE * 2];
+    const char *config = NULL, *profile = NULL, *home = getenv("HOME");
+
+    startup.main_us = monotonic_us();
+    // the configuration file comes first, so anything on the command line overrides it
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--config") == 0)
+        {
+            config = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile = argv[++i];
+        }
+    }
+    if (config == NULL && home)
+    {
+        snprintf(default_config, sizeof(default_config), "%s/%s", home, CONFIG_FILE);
+        config = default_config;
+    }
+    if ((config && config_load(config, profile, config != default_config || profile) != E_OK)
+        || parse_options(argc, argv, 2) != E_OK || (!list_ports && options_check() != E_OK)) // handle user fault 
     {
-        fprintf(stderr, "Usage: %s <tty_device> <baud_rate>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <tty_device|usb:VID:PID[:serial]> <baud_rate> [--list] [--config <file>] [--profile <name>] [--device <tty>] [--baud <rate|auto>] [--autobaud-ms <ms>] [--uevents <socket>] [--framing 8N1] [--flow none|rtscts|xonxoff] [--low-latency] [--rt-priority <1-99>] [--rx-cpu <n>] [--busy-poll [--busy-budget <percent>]] [--rpc <socket>] [--rpc-depth <n>] [--rpc-end <OK,ERROR>] [--rpc-eol <\\r>] [--rpc-tag <prefix>] [--rpc-timeout <ms>] [--mux | --tcp <port> | --rfc2217 <port> | --pipe [--pipe-idle <ms>] | --script <file>] [--triggers <file>] [--capture <file> [--capture-max <MiB>] [--capture-keep <n>]] [--rx-policy block|drop] [--line-idle <ms>] [--scrollback <MiB>] [--paste-delay <ms>] [--max-line <bytes>] [--drain <ms>]\n", argv[0]);
         return E_NOK;  // Exit if incorrect arguments are provided
     }
+    else if (list_ports)
+    {
+        return tty_list();
+    }
     else
     {
-        speed_t boudrate = get_baudrate(argv[2]); // Convert string baudrate to constant value
+        startup.options_us = monotonic_us();
+        int automatic = (strcmp(uart_baud_arg, "auto") == 0);
+        speed_t boudrate = automatic ? B115200 : get_baudrate(uart_baud_arg); // Convert string baudrate to constant value
 
-        if (setup_uart(argv[1], boudrate) < 0) // UART setup
+        if (setup_uart(uart_device, boudrate) < 0 // UART setup
+            || (automatic && (boudrate = autobaud_detect(uart_fd)) == 0))
         {
             return E_NOK;  // Exit if UART setup fails
         }
         else 
         {
-            printf("success to open %s serial port with boudrate %s.\n",argv[1],argv[2]);
+            startup.open_us = monotonic_us();
+            uart_baud = speed_to_baud(boudrate);
+            hotplug.speed = boudrate;
+            // stdout carries the received bytes in --pipe mode, keep it clean
+            fprintf((pipe_mode || script_file) ? stderr : stdout, "success to open %s serial port with boudrate %d (%s).\n",
+                    hotplug.path, uart_baud, uart_framing);
         }
     }
     
-    signal(SIGINT, sigint_handler);  // Register SIGINT signal handler
+    start_us = monotonic_us();
+    clock_gettime(CLOCK_REALTIME, &start_wall);
+    // SIGINT/SIGTERM are blocked here, before any thread exists, so every thread inherits
+    // the mask and the signals are only ever seen through the signalfd of the shutdown thread
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    signal(SIGCHLD, SIG_IGN);        // commands started by triggers are reaped by the kernel
+    signal(SIGPIPE, SIG_IGN);        // a closed stdout pipe (--pipe | head) shows up as EPIPE
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &shut.term) == 0)
+    {
+        shut.term_saved = 1;
+    }
+    shut.signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+    shut.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (shut.signal_fd < 0 || shut.wake_fd < 0
+        || pthread_create(&shutdown_tid, NULL, shutdown_thread, NULL) != 0)
+    {
+        perror("Error setting up shutdown");
+        return E_NOK;
+    }
+    if (hotplug_open() != E_OK)
+    {
+        fprintf(stderr, "no uevents (%s), an unplugged port is looked for every %d ms\n", strerror(errno), HOTPLUG_RETRY_MS);
+    }
+    if (pthread_create(&hotplug_tid, NULL, hotplug_thread, NULL) != 0
+        || pthread_create(&health_tid, NULL, health_thread, NULL) != 0
+        || pthread_create(&modem_tid, NULL, modem_thread, NULL) != 0)
+    {
+        perror("Error creating port threads");
+        return E_NOK;
+    }
+    // the trigger subscriber waits for the automaton, received data queues up in the ring meanwhile
+    pthread_t trigger_tid;
+    if (trigger_file && (pthread_create(&trigger_tid, NULL, trigger_compile_thread, NULL) != 0
+                         || pthread_detach(trigger_tid) != 0))
+    {
+        perror("Error compiling triggers");
+        return E_NOK;
+    }
 
     pthread_mutex_init(&uart_lock, NULL);  // Initialize the mutex lock
 
-    // Create the read and write threads
-    if (pthread_create(&read_tid, NULL, read_uart, NULL) != 0) 
+    port.sink = rx_sink_new(OUT_FLAG_SHELL, -1, "shell");  // R> and R>> replace it
+    if (port.sink == NULL)
     {
-        perror("Error creating read thread");
         return E_NOK;
     }
 
-    if (pthread_create(&write_tid, NULL, write_thread, NULL) != 0) 
+    // the received data goes to the channel decoder, the TCP clients or the shell view
+    struct rx_subscriber *shell = NULL, *scrollback = NULL, *pipe_sub = NULL;
+    if ((mux_mode && rx_subscribe("mux", RX_POLICY_BLOCK, -1, rx_mux) == NULL)
+        || (net_mode && rx_subscribe("net", RX_POLICY_DROP, -1, rx_net) == NULL)
+        || ((pipe_mode || script_file) && (pipe_sub = rx_subscribe("pipe", RX_POLICY_BLOCK, -1, rx_pipe)) == NULL)
+        || (script_file && rx_subscribe("script", RX_POLICY_BLOCK, -1, rx_script) == NULL)
+        || (trigger_file && rx_subscribe("triggers", RX_POLICY_BLOCK, -1, rx_trigger) == NULL)
+        || (!mux_mode && !net_mode && !pipe_mode && !script_file
+            && (shell = rx_subscribe("shell", RX_POLICY_BLOCK, -1, rx_primary)) == NULL)
+        || (shell && scroll.size && (scrollback = rx_subscribe("scrollback", RX_POLICY_BLOCK, -1, rx_scroll)) == NULL))
     {
-        perror("Error creating write thread");
         return E_NOK;
     }
-
-    set_input_mode(RAW_MODE);  // Set the terminal to raw input mode
-
-    // Wait for threads to finish
-    pthread_join(read_tid, NULL);
-    pthread_join(write_tid, NULL);
-
-    set_input_mode(CANONICAL_MODE);  // Reset terminal input mode
-
-    if(dest_fd>=0)
-        close(dest_fd); // Close dest file descriptor
-
-    close(uart_fd);  // Close UART file descriptor
-    pthread_mutex_destroy(&uart_lock);  // Destroy the mutex lock
-
-    return E_OK;  // Exit successfully
-}
-
-/************************************* functions *****************************************/
-// Function to delete characters from the terminal (used for backspace functionality)
-StdReturn delete_chars(unsigned int number)
-{
-    if(number)
+    if (capture_file)
     {
-        for (int i = 0; i < number; i++)
+        int fd = open(capture_file, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+        if (fd < 0 || rx_subscribe(capture_file, rx_capture_policy, fd, rx_capture) == NULL)
         {
-            printf("\b \b");  // Move the cursor back and overwrite with space
+            perror("Error opening capture file");
+            return E_NOK;
         }
-        return E_OK;
     }
-    else
+    if ((rpc.socket_path || rpc.wanted) && rpc_start() != E_OK)
     {
         return E_NOK;
     }
-}
-
-// Function to set terminal input mode (canonical or raw) mode
-StdReturn set_input_mode(char mode)
-{
-    struct termios termios_struct;
-    tcgetattr(STDIN_FILENO, &termios_struct);  // Get the current terminal settings
-
-    if(mode == CANONICAL_MODE)
+    if (shell == NULL)
     {
-        termios_struct.c_lflag |= (ICANON | ECHO);  // Enable canonical mode and echoing
+        scroll.size = 0;  // only the shell has search/grep
     }
-    else if (mode == RAW_MODE)
+    pthread_mutex_lock(&rx.lock);
+    if (shell)
     {
-        termios_struct.c_lflag &= ~(ICANON | ECHO);  // Disable canonical mode and echoing
-        termios_struct.c_cc[VMIN] = 1;  // Set the minimum number of characters to read
-        termios_struct.c_cc[VTIME] = 0; // No timeout for input
+        shell->idle = rx_primary_idle;  // partial lines (prompts of the target) still show up
+        shell->idle_ms = rx_line.idle_ms;
     }
-    else
+    if (scrollback)
     {
-        return E_NOK;
+        scrollback->idle = rx_scroll_idle;
+        scrollback->idle_ms = rx_line.idle_ms;
     }
+    pthread_mutex_unlock(&rx.lock);
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &termios_struct);  // Apply the new settings
-    return E_OK;
-}
-
-// Function to map baudrate string to baudrate constant
-speed_t get_baudrate(const char *baudrate_str) 
-{
-    if (strcmp(baudrate_str, "9600") == 0) 
-        return B9600;
-    else if (strcmp(baudrate_str, "19200") == 0) 
-        return B19200;
-    else if (strcmp(baudrate_str, "38400") == 0) 
-        return B38400;
-    else if (strcmp(baudrate_str, "57600") == 0) 
-        return B57600;
-    else if (strcmp(baudrate_str, "115200") == 0) 
-        return B115200;
-    else 
+    // a real time reader must not wait for a page fault: pages are locked as they are first used,
+    // so the scrollback reservation does not turn into resident memory
+    if (lowlat.rt_priority && mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0)
     {
-        // If the baudrate is unsupported, print error and exit
-        fprintf(stderr, "Unsupported baud rate: %s\n", baudrate_str);
-        exit(1);
+        perror("Error locking memory (the reader may wait for page faults)");
     }
-}
 
-// Function to configure UART settings (baud rate, data bits, stop bits, and parity)
-int setup_uart(const char *device, speed_t baudrate) 
-{
-    uart_fd = open(device, O_RDWR | O_NOCTTY | O_SYNC);  // Open UART device with read/write permissions
-    if (uart_fd < 0) 
+    // Create the read and write threads
+    if (pthread_create(&read_tid, NULL, read_uart, NULL) != 0) 
     {
-        perror("Error opening UART");  // Print error if UART cannot be opened
+        perror("Error creating read thread");
         return E_NOK;
     }
 
-    struct termios options;
-    tcgetattr(uart_fd, &options);  // Get the current UART port settings
-
-    cfsetispeed(&options, baudrate);  // Set the input baud rate
-    cfsetospeed(&options, baudrate);  // Set the output baud rate
-
-    // Set UART port settings for 8 data bits, no parity, and 1 stop bit
-    options.c_cflag &= ~PARENB;  // No parity
-    options.c_cflag &= ~CSTOPB;  // 1 stop bit
-    options.c_cflag &= ~CSIZE;   // Clear the data bits size
-    options.c_cflag |= CS8;      // 8 data bits
-
-    // Disable canonical mode (line-buffered input), echoing, and signal generation
-    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-
-    tcsetattr(uart_fd, TCSANOW, &options);  // Apply the configured UART settings
-    return uart_fd;
-}
-
-// Function to write data to the UART device
-int write_uart(const char *data) 
-{
-    int written_on_uart;
-    pthread_mutex_lock(&uart_lock);                         // Lock the UART access to prevent race conditions
-    written_on_uart = write(uart_fd, data, strlen(data));    // Write the data to UART
-    pthread_mutex_unlock(&uart_lock);                       // Unlock UART access
-    return written_on_uart;
-}
-
-// Function to continuously read data from the UART and display it to the user
-void* read_uart(void* arg) 
-{
-    char buf[BUF_SIZE];  // Buffer to store incoming data
-    while (1) 
+    if (mux_mode)
     {
-        int read_bits = read(uart_fd, buf, BUF_SIZE - 1);  // Read from UART
-        if (read_bits > 0) 
+        // the local console is one of the channel ptys, no prompt on this terminal
+        if (mux_open() != E_OK || pthread_create(&mux_tid, NULL, mux_thread, NULL) != 0)
         {
-            buf[read_bits] = '\0';  // Null-terminate the received data
-
-            if(OUT_FLAG == OUT_FLAG_SHELL)
-            {
-                // Delete previous input text and prepare the terminal for new received data
-                delete_chars(21 + user_input_counter); // 21 = Enter text to send: 
-
-                // Print received data to the terminal
-                printf("\033[0;32mReceived:\033[0m %s\n", buf);
-                fflush(stdout);  // Flush the output buffer to print immediately
+            perror("Error starting multiplexer");
+            return E_NOK;
+        }
+        pthread_join(read_tid, NULL);
+        pthread_join(mux_tid, NULL);
+        return E_OK;
+    }
 
-                // Ask the user to enter text to send after displaying the received data
-                printf("Enter text to send: ");
-                if (user_input_counter) // if there any uncompleted transmit
-                {
-                    printf("%s", user_input);  // Show any partial input if the user started typing
-                }
-                fflush(stdout);  // Ensure immediate output
-            }
-            else if(OUT_FLAG == OUT_FLAG_DEST)
-            {
-                // write to destination
-                int bytes_written = write(dest_fd, buf, read_bits);
-                if (bytes_written != read_bits) 
-                {
-                    perror("Error writing to destination file\n");
-                }
-                else
-                {
-                    // Delete previous input text and prepare the terminal for new received data
-                    delete_chars(21 + user_input_counter); // 21 = Enter text to send: 
+    if (script_file)
+    {
+        return script_run();  // exit code of the script
+    }
 
-                    // Print received data to the terminal
-                    printf("\033[0;32mReceived:\033[0m saved %d to file.\n",bytes_written);
-                    fflush(stdout);  // Flush the output buffer to print immediately
+    if (pipe_mode)
+    {
+        pipe_last_rx = monotonic_ms();
+        if (pthread_create(&pipe_tid, NULL, pipe_thread, NULL) != 0)
+        {
+            perror("Error creating pipe thread");
+            return E_NOK;
+        }
+        pthread_join(pipe_tid, NULL);  // stdin reached EOF
+        tcdrain(uart_fd);              // everything we sent is on the wire
 
-                    // Ask the user to enter text to send after displaying the received data
-                    printf("Enter text to send: ");
-                    if (user_input_counter) // if there any uncompleted transmit
-                    {
-                        printf("%s", user_input);  // Show any partial input if the user started typing
-                    }
-                    fflush(stdout);  // Ensure immediate output
-                }
-            }
+        // answers to the last bytes may still come, leave once the UART went quiet
+        while (monotonic_ms() - __atomic_load_n(&pipe_last_rx, __ATOMIC_RELAXED) < pipe_idle_ms)
+        {
+            usleep(10000);
         }
-        else if (read_bits < 0) 
+        pthread_mutex_lock(&rx.lock);
+        // the cursor moves on before deliver() runs, busy covers the write still in progress
+        while (pipe_sub->used && (pipe_sub->cursor != rx.head || pipe_sub->busy))  // stdout got every slab
         {
-            perror("Error reading from UART\n");  // Print error if reading from UART fails
+            pthread_mutex_unlock(&rx.lock);
+            usleep(1000);
+            pthread_mutex_lock(&rx.lock);
         }
-        usleep(1000);  // Sleep for 1ms to prevent CPU overuse
+        pthread_mutex_unlock(&rx.lock);
+        return E_OK;
     }
-    return E_OK;
-}
 
-// Function to continuously prompt the user for input and send it over UART
-void* write_thread(void* arg) 
-{
-    while (1) 
+    if (net_mode)
     {
-        // Display prompt for user input
-        printf("Enter text to send: ");
-        fflush(stdout);
-
-        for(user_input_counter = 0; user_input_counter < BUF_SIZE - 1;) // get char by char
+        // the UART belongs to the TCP clients, no prompt on this terminal
+        if (net_open() != E_OK || pthread_create(&net_tid, NULL, net_thread, NULL) != 0)
         {
-            user_input[user_input_counter] = getchar();  // Get a character from the user
-            // for fix input buffer ending from the previous data (read_uart function bug)
-            user_input[user_input_counter + 1] = 0;  // Null-terminate the input string
-            
-            if(user_input[user_input_counter] == '\n')  // If user presses Enter
-            {
-                if(user_input_counter)  // If there's actual input (not an empty line)
-                {
-                    delete_chars(21 + user_input_counter);  // Delete previous input
-                    user_input[user_input_counter] = 0;  // Remove the newline character
-
-                    if(strncmp(user_input,"R>",2) == 0) // redirect recieved data to file
-                    {
-                        if(strcmp((const char *)&(user_input[2]),"shell") == 0)
-                        {
-                            printf("Redirection : to shell\n");
-                            OUT_FLAG = OUT_FLAG_SHELL;
-                        }
-                        else
-                        {
-                            // Open the file for writing (create if it doesn't exist, truncate if it exists)
-                            dest_fd = open((const char *)&(user_input[2]), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-                            if (dest_fd == -1) 
-                            {
-                                perror("Error opening destination file\n");
-                            }
-                            else
-                            {
-                                printf("Redirection : to %s\n",&(user_input[2]));
-                                OUT_FLAG = OUT_FLAG_DEST;
-                            }
-                        }
-                    }
-                    else if(strncmp(user_input,"T<",2) == 0) // redirect file to transmit
-                    {
-                            // Open the source file for reading
-                            source_fd = open((const char *)&(user_input[2]), O_RDONLY);
-                            if (source_fd == -1) 
-                            {
-                                perror("Error opening source file\n");
-                            }
-                            else
-                            {
-                                int bytes_read,bytes_written;
-                                char read_buf[BUF_SIZE];
-                                // Read from source and write to destination in chunks
-                                while ((bytes_read = read(source_fd, read_buf, BUF_SIZE)) > 0) 
-                                {
-                                    // if(read_buf[bytes_read-1]== '\n')
-                                    // {
-                                    //     read_buf[bytes_read-1] = 0;
-                                    // }
-                                    bytes_written = write_uart(read_buf);;
-                                    if (bytes_written != bytes_read) 
-                                    {
-                                        perror("Error writing to destination file\n");
-                                    }
-                                    else
-                                    {
-                                        printf("-%s-\n",read_buf);
-                                        // Print the sent-> x bits transmited from y success
-                                        printf("\033[0;31msent->\033[0m%d bits transmited from %s success\n",bytes_read, &(user_input[2]));
-                                    }
-                                }
-                                close(source_fd);
-                            }
-                    }
-                    else
-                    {
-                        printf("\033[0;31msent->\033[0m%s\n", user_input);  // Print the sent-> data
-                        write_uart(user_input);  // Send the input data over UART
-                    }
-
-                    user_input_counter = 0;  // Reset the input counter
-                    break;
-                }
-                else
-                {
-                    // If Enter was pressed without any input, do nothing
-                }
-            }
-            else if(user_input[user_input_counter] == 127)  // Handle backspace (ASCII 127)
-            {
-                if(user_input_counter)
-                {
-                    user_input[user_input_counter - 1] = 0;     // Remove the last character from buf
-                    delete_chars(1);                            // Delete the last character from the terminal
-                    user_input_counter--;                       // Decrement the input counter
-                }
-            }
-            // protect from arrow keys here (future update)
-            else
-            {
-                printf("%c", user_input[user_input_counter]);   // Print the current character
-                user_input_counter++;                           // Increment the input counter
-            }
+            perror("Error starting network bridge");
+            return E_NOK;
         }
+        pthread_join(read_tid, NULL);
+        pthread_join(net_tid, NULL);
+        return E_OK;
     }
-    return E_OK;
-}
-
-// Signal handler for SIGINT (Ctrl+C)kill-signal to cleanly exit
-void sigint_handler(int sig) 
-{
-    delete_chars(21+user_input_counter);  // Clean up the terminal display before exiting
-    printf("Trying to kill, ");
-    cleanup_and_exit();  // Call cleanup and exit
-}
 
-// Function to clean up resources and exit the program gracefully
-void cleanup_and_exit() 
-{
-    if(uart_fd >= 0) 
+    if (pthread_create(&tx_tid, NULL, tx_thread, NULL) != 0) 
     {
-        close(uart_fd);  // Close the UART file descriptor
+        perror("Error creating transmit thread");
+        return E_NOK;
     }
 
-    if(dest_fd >= 0)
+    if (pthread_create(&write_tid, NULL, write_thread, NULL) != 0) 
     {
-        close(dest_fd);  // Close the dest file descriptor
+        perror("Error creating write thread");
+        return E_NOK;
     }
 
-    set_input_mode(CANONICAL_MODE);
-
-    pthread_mutex_destroy(&uart_lock);  // Destroy the mutex lock
-
-    pthread_cancel(read_tid);   // Cancel the read thread
-    pthread_cancel(write_tid);  // Cancel the write thread
+    set_input_mode(RAW_MODE);  // Set the terminal to raw input mode
 
     // Wait for threads to finish
     pthread_join(read_tid, NULL);
     pthread_join(write_tid, NULL);
 
-    printf("successfully terminated\n");
-    exit(E_OK);  // Exit the program
+    set_input_mode(CANONICAL_MODE);  // Reset terminal input mode
+
+    rx_sink_switch(NULL);  // Close dest file descriptor
+
+    close(uart_fd);  // Close UART file descriptor
+    pthread_mutex_destroy(&uart_lock);  // Destroy the mutex lock
+
+    return E_OK;  // Exit successfully
+}
+
+/************************************* functions *****************************************/
+// Function to parse the command line (or one setting of the configuration file)
+StdReturn parse_options(int argc, char *argv[], int positional)
+{
+    int given = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' && given < positional)
+        {
+            // <tty_device> <baud_rate> as before, they override the profile
+            if (given++ == 0)
+            {
+                uart_device = argv[i];
+            }
+            else
+            {
+                uart_baud_arg = argv[i];
+            }
+        }
+        else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+        {
+            uart_device = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+        {
+            uart_baud_arg = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--config") == 0 || strcmp(argv[i], "--profile") == 0) && i + 1 < argc)
+        {
+            i++;  // applied by config_load() before the command line
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            list_ports = 1;
+        }
+        else if (strcmp(argv[i], "--uevents") == 0 && i + 1 < argc)
+        {
+            hotplug.sim_path = argv[++i];  // simulated uevent source instead of the kernel
+        }
+        else if (strcmp(argv[i], "--low-latency") == 0)
+        {
+            lowlat.enabled = 1;
+        }
+        else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc)
+        {
+            lowlat.rt_priority = atoi(argv[++i]);
+            if (lowlat.rt_priority < 1 || lowlat.rt_priority > 99)
+            {
+                fprintf(stderr, "Unsupported real time priority: %s (1-99)\n", argv[i]);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--rx-cpu") == 0 && i + 1 < argc)
+        {
+            lowlat.rx_cpu = atoi(argv[++i]);
+            if (lowlat.rx_cpu < 0 || lowlat.rx_cpu >= CPU_SETSIZE)
+            {
+                fprintf(stderr, "Unsupported CPU: %s\n", argv[i]);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--busy-poll") == 0)
+        {
+            busy.enabled = 1;
+        }
+        else if (strcmp(argv[i], "--busy-budget") == 0 && i + 1 < argc)
+        {
+            busy.budget = atoi(argv[++i]);
+            if (busy.budget < 1 || busy.budget > 100)
+            {
+                fprintf(stderr, "Unsupported busy poll budget: %s (1-100 percent of a CPU)\n", argv[i]);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--rpc") == 0 && i + 1 < argc)
+        {
+            rpc.socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rpc-depth") == 0 && i + 1 < argc)
+        {
+            rpc.depth = atoi(argv[++i]);
+            if (rpc.depth < 1 || rpc.depth > RPC_DEPTH_MAX)
+            {
+                fprintf(stderr, "Unsupported RPC depth: %s (1-%d)\n", argv[i], RPC_DEPTH_MAX);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--rpc-timeout") == 0 && i + 1 < argc)
+        {
+            rpc.timeout_ms = atoi(argv[++i]);
+            if (rpc.timeout_ms < 1)  // every request would time out as soon as it was written
+            {
+                fprintf(stderr, "Unsupported RPC timeout: %s (milliseconds, at least 1)\n", argv[i]);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--rpc-tag") == 0 && i + 1 < argc)
+        {
+            rpc.tag = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rpc-eol") == 0 && i + 1 < argc)
+        {
+            rpc.eol_len = rpc_unescape(argv[++i], rpc.eol, sizeof(rpc.eol));
+        }
+        else if (strcmp(argv[i], "--rpc-end") == 0 && i + 1 < argc)
+        {
+            // comma separated, the first one means success: "OK,ERROR,+CME ERROR"
+            char *list = strdup(argv[++i]), *save = NULL;
+            rpc.end_count = 0;
+            for (char *end = strtok_r(list, ",", &save); end && rpc.end_count < RPC_ENDS; end = strtok_r(NULL, ",", &save))
+            {
+                rpc_unescape(end, rpc.ends[rpc.end_count++], sizeof(rpc.ends[0]));
+            }
+            free(list);
+            if (rpc.end_count == 0)
+            {
+                fprintf(stderr, "--rpc-end needs at least one terminator\n");
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--autobaud-ms") == 0 && i + 1 < argc)
+        {
+            autobaud.budget_ms = atoi(argv[++i]);  // longer for targets that print rarely
+        }
+        else if (strcmp(argv[i], "--framing") == 0 && i + 1 < argc)
+        {
+            const char *f = argv[++i];
+            if (strlen(f) != 3 || f[0] < '5' || f[0] > '8' || strchr("NEO", f[1]) == NULL || (f[2] != '1' && f[2] != '2'))
+            {
+                fprintf(stderr, "Unsupported framing: %s (data bits 5-8, parity N/E/O, stop bits 1/2)\n", f);
+                return E_NOK;
+            }
+            memcpy(uart_framing, f, 4);
+        }
+        else if (strcmp(argv[i], "--flow") == 0 && i + 1 < argc)
+        {
+            const char *flow = argv[++i];
+            if (strcmp(flow, "none") == 0)
+            {
+                uart_flow = FLOW_NONE;
+            }
+            else if (strcmp(flow, "rtscts") == 0)
+            {
+                uart_flow = FLOW_RTSCTS;
+            }
+            else if (strcmp(flow, "xonxoff") == 0)
+            {
+                uart_flow = FLOW_XONXOFF;
+            }
+            else
+            {
+                fprintf(stderr, "Unsupported flow control: %s (none, rtscts or xonxoff)\n", flow);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            capture_file = argv[++i];  // like R+file right from the start
+        }
+        else if (strcmp(argv[i], "--capture-max") == 0 && i + 1 < argc)
+        {
+            capture_max = (unsigned long long)atoi(argv[++i]) << 20;  // 0 never rotates
+        }
+        else if (strcmp(argv[i], "--capture-keep") == 0 && i + 1 < argc)
+        {
+            capture_keep = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mux") == 0)
+        {
+            mux_mode = 1;  // console, log and bulk channels over one UART
+        }
+        else if ((strcmp(argv[i], "--tcp") == 0 || strcmp(argv[i], "--rfc2217") == 0) && i + 1 < argc)
+        {
+            net_mode = 1;  // bridge the UART to TCP clients
+            net.rfc2217 = (strcmp(argv[i], "--rfc2217") == 0);
+            net.port = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pipe") == 0)
+        {
+            pipe_mode = 1;  // raw streaming for shell pipelines
+        }
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+        {
+            script_file = argv[++i];  // send/expect automation, received data shown on stdout
+        }
+        else if (strcmp(argv[i], "--triggers") == 0 && i + 1 < argc)
+        {
+            trigger_file = argv[++i];  // patterns watched on the received data
+        }
+        else if (strcmp(argv[i], "--scrollback") == 0 && i + 1 < argc)
+        {
+            scroll.size = (unsigned long long)atoi(argv[++i]) << 20;  // 0 turns it off
+        }
+        else if (strcmp(argv[i], "--line-idle") == 0 && i + 1 < argc)
+        {
+            rx_line.idle_ms = atoi(argv[++i]);  // when a line without newline is shown anyway
+        }
+        else if (strcmp(argv[i], "--max-line") == 0 && i + 1 < argc)
+        {
+            input_max = atoi(argv[++i]);  // hard cap of one input line
+        }
+        else if (strcmp(argv[i], "--drain") == 0 && i + 1 < argc)
+        {
+            shut.drain_ms = atoi(argv[++i]);  // how long pending data may take to leave on exit
+        }
+        else if (strcmp(argv[i], "--paste-delay") == 0 && i + 1 < argc)
+        {
+            paste_delay_ms = atoi(argv[++i]);  // for targets that lose characters of a burst
+        }
+        else if (strcmp(argv[i], "--pipe-idle") == 0 && i + 1 < argc)
+        {
+            pipe_idle_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rx-policy") == 0 && i + 1 < argc)
+        {
+            // what a capture file that can not keep up does: hold back the UART or lose data
+            rx_capture_policy = (strcmp(argv[++i], "drop") == 0) ? RX_POLICY_DROP : RX_POLICY_BLOCK;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return E_NOK;
+        }
+    }
+    return E_OK;
+}
+
+// Function to apply the [default] section and the selected profile of the configuration file
+StdReturn config_load(const char *file, const char *profile, int required)
+{
+    struct stat st;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (required)
+        {
+            perror("Error opening configuration file");
+            return E_NOK;
+        }
+        return E_OK;  // no configuration, the command line says everything
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        if (profile)
+        {
+            fprintf(stderr, "%s: no profile [%s]\n", file, profile);
+            return E_NOK;
+        }
+        return E_OK;
+    }
+    char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        perror("Error reading configuration file");
+        return E_NOK;
+    }
+
+    const char *p = text, *end = text + st.st_size;
+    int line_no = 0, active = 0, found = (profile == NULL), status = E_OK;
+    while (p < end && status == E_OK)
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+        line_no++;
+        while (p < eol && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+
+        if (p < eol && *p == '[')
+        {
+            // [name]: only [default] and the selected profile are read, the lines of every other
+            // section are skipped without being parsed, so a large file costs almost nothing
+            const char *close_br = memchr(p, ']', eol - p);
+            int len = close_br ? close_br - p - 1 : 0;
+            active = (len == (int)strlen(CONFIG_DEFAULT) && memcmp(p + 1, CONFIG_DEFAULT, len) == 0);
+            if (profile && len == (int)strlen(profile) && memcmp(p + 1, profile, len) == 0)
+            {
+                active = 1;
+                found = 1;
+            }
+        }
+        else if (active && p < eol && *p != '#' && *p != ';' && *p != '\r')
+        {
+            // key = value, "quoted" when it holds spaces or '#'
+            char line[BUF_SIZE * 2], option[BUF_SIZE * 2 + 2];
+            int len = (eol - p < (int)sizeof(line)) ? eol - p : (int)sizeof(line) - 1;
+            memcpy(line, p, len);
+            line[len] = '\0';
+
+            char *value = strchr(line, '=');
+            char *key = line, *tail;
+            if (value == NULL)
+            {
+                fprintf(stderr, "%s:%d: expected key = value\n", file, line_no);
+                status = E_NOK;
+                break;
+            }
+            tail = value;
+            while (tail > key && (tail[-1] == ' ' || tail[-1] == '\t'))
+            {
+                tail--;
+            }
+            *tail = '\0';
+            value++;
+            while (*value == ' ' || *value == '\t')
+            {
+                value++;
+            }
+            if (*value == '"' && (tail = strchr(value + 1, '"')) != NULL)
+            {
+                *tail = '\0';
+                value++;
+            }
+            else
+            {
+                tail = value + strcspn(value, "#;\r");  // comment after the value
+                while (tail > value && (tail[-1] == ' ' || tail[-1] == '\t'))
+                {
+                    tail--;
+                }
+                *tail = '\0';
+            }
+
+            // every setting is the command line option of the same name
+            snprintf(option, sizeof(option), "--%s", key);
+            char *args[3] = { (char *)file, option, strdup(value) };  // options keep pointers to values
+            int argc = 3;
+            if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "on") == 0)
+            {
+                argc = 2;  // a switch like --mux
+            }
+            if (strcmp(value, "false") != 0 && strcmp(value, "no") != 0 && strcmp(value, "off") != 0
+                && parse_options(argc, args, 0) != E_OK)
+            {
+                fprintf(stderr, "%s:%d: invalid setting %s = %s\n", file, line_no, key, value);
+                status = E_NOK;
+            }
+        }
+        p = eol + 1;
+    }
+    munmap(text, st.st_size);
+
+    if (status == E_OK && !found)
+    {
+        fprintf(stderr, "%s: no profile [%s]\n", file, profile);
+        status = E_NOK;
+    }
+    return status;
+}
+
+// Function to check the options once the configuration file and the command line were applied
+StdReturn options_check(void)
+{
+    if (uart_device == NULL || uart_baud_arg == NULL)
+    {
+        fprintf(stderr, "No serial port or baudrate given\n");
+        return E_NOK;
+    }
+    if (mux_mode + net_mode + pipe_mode + (script_file != NULL) > 1)
+    {
+        fprintf(stderr, "--mux, --tcp/--rfc2217, --pipe and --script can not be combined\n");
+        return E_NOK;
+    }
+    if (busy.enabled && lowlat.rt_priority && busy.budget == 100 && lowlat.rx_cpu < 0)
+    {
+        // a real time thread that never blocks takes its CPU away from everything else
+        fprintf(stderr, "--busy-poll with --rt-priority needs --rx-cpu or a --busy-budget below 100\n");
+        return E_NOK;
+    }
+    if (script_file && script_load(script_file) != E_OK)
+    {
+        return E_NOK;
+    }
+    if (trigger_file && trigger_load(trigger_file) != E_OK)
+    {
+        return E_NOK;
+    }
+    return E_OK;
+}
+
+// Function to delete characters from the terminal (used for backspace functionality)
+StdReturn delete_chars(unsigned int number)
+{
+    if(number)
+    {
+        for (int i = 0; i < number; i++)
+        {
+            printf("\b \b");  // Move the cursor back and overwrite with space
+        }
+        return E_OK;
+    }
+    else
+    {
+        return E_NOK;
+    }
+}
+
+// Function to set terminal input mode (canonical or raw) mode
+StdReturn set_input_mode(char mode)
+{
+    struct termios termios_struct;
+    tcgetattr(STDIN_FILENO, &termios_struct);  // Get the current terminal settings
+
+    if(mode == CANONICAL_MODE)
+    {
+        termios_struct.c_lflag |= (ICANON | ECHO);  // Enable canonical mode and echoing
+    }
+    else if (mode == RAW_MODE)
+    {
+        termios_struct.c_lflag &= ~(ICANON | ECHO);  // Disable canonical mode and echoing
+        termios_struct.c_cc[VMIN] = 1;  // Set the minimum number of characters to read
+        termios_struct.c_cc[VTIME] = 0; // No timeout for input
+    }
+    else
+    {
+        return E_NOK;
+    }
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &termios_struct);  // Apply the new settings
+    if (isatty(STDOUT_FILENO))
+    {
+        // bracketed paste: the terminal marks pasted text so it is not taken for typing
+        printf(mode == RAW_MODE ? "\033[?2004h" : "\033[?2004l");
+        fflush(stdout);
+    }
+    return E_OK;
+}
+
+// Function to map baudrate string to baudrate constant
+speed_t get_baudrate(const char *baudrate_str) 
+{
+    char digits[16];
+    speed_t speed = baud_to_speed(atoi(baudrate_str));
+
+    // the string must be exactly the number, "9600x" is refused
+    snprintf(digits, sizeof(digits), "%d", atoi(baudrate_str));
+    if (speed && strcmp(digits, baudrate_str) == 0)
+    {
+        return speed;
+    }
+    else 
+    {
+        // If the baudrate is unsupported, print error and exit
+        fprintf(stderr, "Unsupported baud rate: %s\n", baudrate_str);
+        exit(1);
+    }
+}
+
+// supported baudrates and their termios constants
+const struct { int baud; speed_t speed; } baud_table[] =
+{
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+};
+
+// Function to map a numeric baudrate to its constant (0 if unsupported)
+speed_t baud_to_speed(int baud)
+{
+    for (unsigned int i = 0; i < sizeof(baud_table) / sizeof(baud_table[0]); i++)
+    {
+        if (baud_table[i].baud == baud)
+        {
+            return baud_table[i].speed;
+        }
+    }
+    return 0;
+}
+
+// Function to map a baudrate constant back to bits per second
+int speed_to_baud(speed_t speed)
+{
+    for (unsigned int i = 0; i < sizeof(baud_table) / sizeof(baud_table[0]); i++)
+    {
+        if (baud_table[i].speed == speed)
+        {
+            return baud_table[i].baud;
+        }
+    }
+    return 0;
+}
+
+// Function to configure UART settings (baud rate, data bits, stop bits, and parity)
+int setup_uart(const char *device, speed_t baudrate) 
+{
+    snprintf(hotplug.spec, sizeof(hotplug.spec), "%s", device);  // kept to find the port again
+    hotplug.speed = baudrate;
+    if (tty_resolve(device, hotplug.path, sizeof(hotplug.path)) != E_OK)
+    {
+        fprintf(stderr, "No serial port matches %s (--list shows them)\n", device);
+        return E_NOK;
+    }
+
+    uart_fd = open(hotplug.path, O_RDWR | O_NOCTTY | O_SYNC);  // Open UART device with read/write permissions
+    if (uart_fd < 0) 
+    {
+        perror("Error opening UART");  // Print error if UART cannot be opened
+        return E_NOK;
+    }
+    uart_configure(uart_fd, baudrate);
+    link_low_latency(uart_fd, hotplug.path);
+    return uart_fd;
+}
+
+// Function to apply the termios settings of the options to an open port
+void uart_configure(int fd, speed_t baudrate)
+{
+    struct termios options;
+    tcgetattr(fd, &options);  // Get the current UART port settings
+
+    cfsetispeed(&options, baudrate);  // Set the input baud rate
+    cfsetospeed(&options, baudrate);  // Set the output baud rate
+
+    // Set the data bits, parity and stop bits of --framing (8N1 unless the profile says otherwise)
+    const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+    options.c_cflag &= ~(PARENB | PARODD | CSTOPB | CSIZE | CRTSCTS);
+    options.c_cflag |= sizes[uart_framing[0] - '5'];
+    if (uart_framing[1] != 'N')
+    {
+        options.c_cflag |= PARENB | (uart_framing[1] == 'O' ? PARODD : 0);
+    }
+    if (uart_framing[2] == '2')
+    {
+        options.c_cflag |= CSTOPB;
+    }
+
+    // Disable canonical mode (line-buffered input), echoing, and signal generation
+    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG | IEXTEN);
+
+    // Pass every byte unmodified: no CR/NL translation, no XON/XOFF, no output processing
+    options.c_iflag &= ~(IGNBRK | BRKINT | IGNPAR | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+    // except line errors: a break or a byte with a framing/parity error arrives as 0xFF 0x00 <byte>
+    // and a real 0xFF as 0xFF 0xFF, link_unmark() turns that back into the bytes sent
+    options.c_iflag |= PARMRK | INPCK;
+    options.c_oflag &= ~OPOST;
+    options.c_cflag |= CREAD | CLOCAL;  // enable the receiver, ignore modem control lines
+    if (uart_flow == FLOW_RTSCTS)
+    {
+        options.c_cflag |= CRTSCTS;
+    }
+    else if (uart_flow == FLOW_XONXOFF)
+    {
+        options.c_iflag |= IXON | IXOFF;
+    }
+    options.c_cc[VMIN] = busy.enabled ? 0 : 1;  // read() returns as soon as one byte arrived (at once for --busy-poll)
+    options.c_cc[VTIME] = 0;
+
+    tcsetattr(fd, TCSANOW, &options);  // Apply the configured UART settings
+}
+
+// Function to approximate log2(x) in 1/256 bits, for the entropy of a sample without libm
+int log2_q8(unsigned int x)
+{
+    int e = 31 - __builtin_clz(x);
+    // the bits after the leading one are a linear approximation of the fraction (error < 0.09 bit)
+    return e * 256 + (int)(((unsigned long long)x << 8 >> e) & 0xFF);
+}
+
+// Function to sample the port at one rate, returns the score of the decoded text (0-100)
+int autobaud_sample(int fd, speed_t speed, char *out, int *out_len, int *confident)
+{
+    unsigned char raw[AUTOBAUD_SAMPLE * 2];
+    int raw_len = 0, len = 0, errors = 0, printable = 0, score;
+    int histogram[256] = { 0 };
+    struct termios options;
+
+    // framing and parity errors arrive as 0xFF 0x00 <byte>, a real 0xFF as 0xFF 0xFF (uart_configure)
+    tcgetattr(fd, &options);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    tcsetattr(fd, TCSANOW, &options);
+    tcflush(fd, TCIFLUSH);  // bytes received at the previous rate
+
+    long long deadline = monotonic_ms() + autobaud.budget_ms;
+    while (raw_len < AUTOBAUD_SAMPLE)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        long long left = deadline - monotonic_ms();
+        if (left <= 0 || poll(&pfd, 1, left) <= 0)
+        {
+            break;
+        }
+        int n = read(fd, raw + raw_len, sizeof(raw) - raw_len);
+        if (n <= 0)
+        {
+            break;
+        }
+        raw_len += n;
+    }
+
+    for (int i = 0; i < raw_len && len < AUTOBAUD_SAMPLE; i++)
+    {
+        if (raw[i] != 0xFF)
+        {
+            out[len++] = raw[i];
+        }
+        else if (i + 1 < raw_len && raw[i + 1] == 0xFF)
+        {
+            out[len++] = (char)0xFF;
+            i++;
+        }
+        else
+        {
+            errors++;  // a byte received with a framing/parity error (or a break)
+            i += 2;
+        }
+    }
+    *out_len = len;
+    *confident = 0;
+    if (len < 4)
+    {
+        return 0;  // nothing to judge
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        unsigned char c = out[i];
+        histogram[c]++;
+        printable += (c >= 0x20 && c < 0x7F) || c == '\r' || c == '\n' || c == '\t' || c == 0x1B;
+    }
+    // Shannon entropy: text is around 4-5 bits per byte, a wrong rate gives either a few repeated
+    // values (0x00, 0x80, 0xF8) or noise close to 8 bits
+    int entropy = log2_q8(len) * len;
+    for (int c = 0; c < 256; c++)
+    {
+        if (histogram[c])
+        {
+            entropy -= histogram[c] * log2_q8(histogram[c]);
+        }
+    }
+    entropy /= len;
+
+    score = printable * 100 / len - errors * 200 / (len + errors);
+    if (entropy < 2 * 256 || entropy > 6 * 256)
+    {
+        score /= 2;
+    }
+    *confident = (len >= AUTOBAUD_CONFIDENT && errors == 0 && printable * 100 >= len * 95
+                  && entropy >= 2 * 256 && entropy <= 6 * 256);
+    return score > 0 ? score : 0;
+}
+
+// Function to find the rate the target sends at, returns its constant or 0
+speed_t autobaud_detect(int fd)
+{
+    char sample[AUTOBAUD_SAMPLE];
+    int count = sizeof(autobaud_order) / sizeof(autobaud_order[0]);
+    int best = -1, best_score = 0, tried = 0, len, confident = 0;
+    long long begin = monotonic_ms();
+
+    // the common rates come first, a rate giving clean text ends the search at once
+    for (int i = 0; i < count && !confident; i++)
+    {
+        int score = autobaud_sample(fd, baud_to_speed(autobaud_order[i]), sample, &len, &confident);
+        tried++;
+        fprintf(stderr, "autobaud: %6d baud, %3d bytes, score %d\n", autobaud_order[i], len, score);
+        if (score > best_score)
+        {
+            best = i;
+            best_score = score;
+            memcpy(autobaud.keep, sample, len);
+            autobaud.keep_len = len;
+        }
+    }
+    if (best < 0 || best_score < AUTOBAUD_MIN_SCORE)
+    {
+        fprintf(stderr, "autobaud: no rate gave readable text in %lld ms, is the target printing?\n", monotonic_ms() - begin);
+        return 0;
+    }
+
+    speed_t speed = baud_to_speed(autobaud_order[best]);
+    uart_configure(fd, speed);
+    if (best != tried - 1)
+    {
+        tcflush(fd, TCIFLUSH);  // received at the rate tried last
+    }
+    fprintf(stderr, "autobaud: %d baud (score %d, %d of %d rates tried in %lld ms)\n",
+            autobaud_order[best], best_score, tried, count, monotonic_ms() - begin);
+    return speed;
+}
+
+// Function to read one sysfs attribute, without the trailing newline
+StdReturn sysfs_read(const char *dir, const char *attr, char *out, int size)
+{
+    char path[PATH_MAX + BUF_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return E_NOK;
+    }
+    int len = read(fd, out, size - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return E_NOK;
+    }
+    while (len > 0 && (out[len - 1] == '\n' || out[len - 1] == ' '))
+    {
+        len--;
+    }
+    out[len] = '\0';
+    return E_OK;
+}
+
+// Function to write one sysfs attribute
+StdReturn sysfs_write(const char *dir, const char *attr, const char *value)
+{
+    char path[PATH_MAX + BUF_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return E_NOK;
+    }
+    int len = strlen(value);
+    int ret = write(fd, value, len);
+    close(fd);
+    return ret == len ? E_OK : E_NOK;
+}
+
+// Function to make the driver of an open port hand over received bytes at once (--low-latency)
+void link_low_latency(int fd, const char *path)
+{
+    char dir[PATH_MAX], value[16];
+    struct serial_struct serial;
+
+    if (!lowlat.enabled)
+    {
+        return;
+    }
+    // serial drivers without the flag (most USB adapters) accept and ignore it or refuse TIOCGSERIAL
+    int have_serial = (ioctl(fd, TIOCGSERIAL, &serial) == 0);
+    // FTDI adapters send a partly filled USB packet only after latency_timer ms
+    snprintf(dir, sizeof(dir), SYS_TTY "/%s/device", strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+    int have_timer = (sysfs_read(dir, "latency_timer", value, sizeof(value)) == E_OK);
+    if (!lowlat.saved)
+    {
+        lowlat.saved = 1;
+        lowlat.serial_was = have_serial ? (serial.flags & ASYNC_LOW_LATENCY) != 0 : -1;
+        lowlat.timer_was = have_timer ? atoi(value) : -1;
+    }
+
+    lowlat.serial_now = 0;
+    if (have_serial)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        lowlat.serial_now = (ioctl(fd, TIOCSSERIAL, &serial) == 0);
+    }
+    lowlat.timer_now = -1;
+    if (have_timer)
+    {
+        snprintf(value, sizeof(value), "%d", LATENCY_TIMER_MS);
+        if (sysfs_write(dir, "latency_timer", value) != E_OK)
+        {
+            fprintf(stderr, "can not set %s/latency_timer (%s), it stays at %s ms\n", dir, strerror(errno),
+                    sysfs_read(dir, "latency_timer", value, sizeof(value)) == E_OK ? value : "?");
+        }
+        if (sysfs_read(dir, "latency_timer", value, sizeof(value)) == E_OK)
+        {
+            lowlat.timer_now = atoi(value);
+        }
+    }
+}
+
+// Function to put the low latency settings of the port back as they were at startup
+void link_low_latency_restore(void)
+{
+    char dir[PATH_MAX], value[16];
+    struct serial_struct serial;
+
+    if (!lowlat.enabled || hotplug.lost)
+    {
+        return;
+    }
+    if (lowlat.serial_was == 0 && ioctl(uart_fd, TIOCGSERIAL, &serial) == 0)
+    {
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+        ioctl(uart_fd, TIOCSSERIAL, &serial);
+    }
+    if (lowlat.timer_was >= 0)
+    {
+        // the sysfs setting outlives the program, unlike the termios settings
+        snprintf(dir, sizeof(dir), SYS_TTY "/%s/device", strrchr(hotplug.path, '/') + 1);
+        snprintf(value, sizeof(value), "%d", lowlat.timer_was);
+        sysfs_write(dir, "latency_timer", value);
+    }
+}
+
+// Function to read the ids of the USB device a tty belongs to, E_NOK when it is no USB tty
+StdReturn tty_usb_ids(const char *name, char *vid, char *pid, char *serial, char *product)
+{
+    char link[PATH_MAX], dir[PATH_MAX];
+    snprintf(link, sizeof(link), SYS_TTY "/%s/device", name);
+    if (realpath(link, dir) == NULL)
+    {
+        return E_NOK;  // virtual terminal or pty
+    }
+    // the tty hangs below its USB interface (ttyACM) or a port of the interface (ttyUSB),
+    // idVendor and idProduct are on the USB device above them
+    for (int depth = 0; depth < 4; depth++)
+    {
+        if (sysfs_read(dir, "idVendor", vid, 8) == E_OK && sysfs_read(dir, "idProduct", pid, 8) == E_OK)
+        {
+            if (sysfs_read(dir, "serial", serial, BUF_SIZE) != E_OK)
+            {
+                serial[0] = '\0';
+            }
+            if (sysfs_read(dir, "product", product, BUF_SIZE) != E_OK)
+            {
+                product[0] = '\0';
+            }
+            return E_OK;
+        }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || slash == dir)
+        {
+            break;
+        }
+        *slash = '\0';
+    }
+    return E_NOK;
+}
+
+// Function to turn a device (path or usb:VID:PID[:serial]) into the node to open
+StdReturn tty_resolve(const char *spec, char *path, int size)
+{
+    char want_vid[8], want_pid[8], vid[8], pid[8], serial[BUF_SIZE], product[BUF_SIZE];
+    const char *want_serial;
+    struct dirent **names;
+    int count, found = 0;
+
+    if (strncmp(spec, USB_SPEC, strlen(USB_SPEC)) != 0)
+    {
+        // a path: links like /dev/serial/by-id/... are followed, uevents name the real node
+        if (realpath(spec, path) == NULL)
+        {
+            snprintf(path, size, "%s", spec);
+        }
+        return E_OK;
+    }
+    if (sscanf(spec + strlen(USB_SPEC), "%4[0-9a-fA-F]:%4[0-9a-fA-F]", want_vid, want_pid) != 2)
+    {
+        return E_NOK;
+    }
+    want_serial = strchr(spec + strlen(USB_SPEC) + strlen(want_vid) + 1, ':');
+
+    // sorted, so two adapters with the same ids and no serial always give the same choice
+    count = scandir(SYS_TTY, &names, NULL, alphasort);
+    for (int i = 0; i < count; i++)
+    {
+        if (!found && names[i]->d_name[0] != '.'
+            && tty_usb_ids(names[i]->d_name, vid, pid, serial, product) == E_OK
+            && strcasecmp(vid, want_vid) == 0 && strcasecmp(pid, want_pid) == 0
+            && (want_serial == NULL || strcmp(serial, want_serial + 1) == 0))
+        {
+            snprintf(path, size, "/dev/%s", names[i]->d_name);
+            found = 1;
+        }
+        free(names[i]);
+    }
+    if (count >= 0)
+    {
+        free(names);
+    }
+    return found ? E_OK : E_NOK;
+}
+
+// Function to list the serial ports with their USB ids (--list)
+int tty_list(void)
+{
+    char link[PATH_MAX], dir[PATH_MAX], vid[8], pid[8], serial[BUF_SIZE], product[BUF_SIZE];
+    struct dirent **names;
+    int count = scandir(SYS_TTY, &names, NULL, alphasort);
+    if (count < 0)
+    {
+        perror("Error reading " SYS_TTY);
+        return E_NOK;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = names[i]->d_name;
+        snprintf(link, sizeof(link), SYS_TTY "/%s/device", name);
+        if (name[0] == '.' || realpath(link, dir) == NULL)
+        {
+            // consoles and ptys have no device
+        }
+        else if (tty_usb_ids(name, vid, pid, serial, product) == E_OK)
+        {
+            printf("/dev/%-10s usb:%s:%s%s%s  %s\n", name, vid, pid, serial[0] ? ":" : "", serial, product);
+        }
+        else if (strstr(dir, "serial8250") == NULL)  // the 8250 driver registers ports that may not exist
+        {
+            printf("/dev/%-10s %s\n", name, strrchr(dir, '/') + 1);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return E_OK;
+}
+
+// Function to print a port message above the prompt (or to stderr without the shell view)
+void port_notice(const char *tag, const char *format, ...)
+{
+    int shell = !mux_mode && !net_mode && !pipe_mode && !script_file;
+    FILE *out = shell ? stdout : stderr;
+    va_list args;
+
+    if (shell)
+    {
+        clear_prompt();
+    }
+    va_start(args, format);
+    fprintf(out, "\033[1;33m[%s]\033[0m ", tag);
+    vfprintf(out, format, args);
+    fprintf(out, "\n");
+    va_end(args);
+    if (shell)
+    {
+        redraw_prompt();
+    }
+}
+
+// Function to release a port that went away, writers see /dev/null until it is back
+void port_lost(unsigned long long generation)
+{
+    pthread_mutex_lock(&hotplug.lock);
+    // a call blocked since before the last reopen (splice waiting for stdin) fails on the old port
+    if (!hotplug.lost && generation == hotplug.generation)
+    {
+        hotplug.term_saved = (tcgetattr(uart_fd, &hotplug.term) == 0);
+        // closing the tty lets the kernel free its name, so the replugged adapter usually gets it again
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, uart_fd);
+            close(null_fd);
+        }
+        hotplug.lost = 1;
+        hotplug.losses++;
+        port_notice("hotplug", "%s lost, captures and scrollback stay open until it is back", hotplug.path);
+    }
+    pthread_mutex_unlock(&hotplug.lock);
+}
+
+// Function to wait until a lost port was opened again
+void port_wait(void)
+{
+    pthread_mutex_lock(&hotplug.lock);
+    while (hotplug.lost)
+    {
+        pthread_cond_wait(&hotplug.back, &hotplug.lock);
+    }
+    pthread_mutex_unlock(&hotplug.lock);
+}
+
+// Function to open the port again and put it in place of /dev/null
+StdReturn port_reopen(long long event_us)
+{
+    char path[PATH_MAX];
+    if (tty_resolve(hotplug.spec, path, sizeof(path)) != E_OK)
+    {
+        return E_NOK;  // not plugged in (yet)
+    }
+    int fd = open(path, O_RDWR | O_NOCTTY | O_SYNC | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return E_NOK;  // node not created yet or udev did not set its permissions yet, retried
+    }
+    pthread_mutex_lock(&hotplug.lock);
+    if (hotplug.term_saved)
+    {
+        tcsetattr(fd, TCSANOW, &hotplug.term);
+    }
+    else
+    {
+        uart_configure(fd, hotplug.speed);
+    }
+    link_low_latency(fd, path);  // a new adapter starts with the driver defaults
+    dup2(fd, uart_fd);  // every thread keeps using the same descriptor number
+    close(fd);
+    long long took_us = monotonic_us() - event_us;
+    if (took_us > hotplug.reopen_max_us)
+    {
+        hotplug.reopen_max_us = took_us;
+    }
+    snprintf(hotplug.path, sizeof(hotplug.path), "%s", path);
+    hotplug.lost = 0;
+    hotplug.generation++;
+    hotplug.reopens++;
+    port_notice("hotplug", "%s is back, reopened in %lld us", path, took_us);
+    pthread_cond_broadcast(&hotplug.back);
+    pthread_mutex_unlock(&hotplug.lock);
+    return E_OK;
+}
+
+// Function to open the uevent socket, netlink or the simulated source of --uevents
+StdReturn hotplug_open(void)
+{
+    if (hotplug.sim_path)
+    {
+        // datagrams in the kernel format: "action@devpath\0KEY=value\0..."
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", hotplug.sim_path);
+        unlink(hotplug.sim_path);
+        hotplug.event_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (hotplug.event_fd >= 0 && bind(hotplug.event_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            return E_OK;
+        }
+    }
+    else
+    {
+        struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };  // kernel events, not udev's
+        hotplug.event_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (hotplug.event_fd >= 0 && bind(hotplug.event_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            return E_OK;
+        }
+    }
+    if (hotplug.event_fd >= 0)
+    {
+        close(hotplug.event_fd);
+        hotplug.event_fd = -1;
+    }
+    return E_NOK;
+}
+
+// Function to watch the uevents and reopen the port when it comes back
+void* hotplug_thread(void* arg)
+{
+    char msg[UEVENT_BUF + 1];
+
+    while (1)
+    {
+        struct pollfd pfd = { hotplug.event_fd, POLLIN, 0 };
+        int ready = poll(&pfd, hotplug.event_fd >= 0 ? 1 : 0, HOTPLUG_RETRY_MS);
+        long long event_us = monotonic_us();
+        int lost = __atomic_load_n(&hotplug.lost, __ATOMIC_RELAXED);
+
+        if (ready > 0)
+        {
+            struct sockaddr_storage from;
+            socklen_t from_len = sizeof(from);
+            int len = recvfrom(hotplug.event_fd, msg, UEVENT_BUF, 0, (struct sockaddr *)&from, &from_len);
+            if (len <= 0 || (hotplug.sim_path == NULL && ((struct sockaddr_nl *)&from)->nl_pid != 0))
+            {
+                continue;  // only the kernel sends uevents on netlink
+            }
+            msg[len] = '\0';
+
+            const char *action = "", *subsystem = "", *devname = "";
+            for (char *field = msg; field < msg + len; field += strlen(field) + 1)
+            {
+                if (strncmp(field, "ACTION=", 7) == 0)
+                {
+                    action = field + 7;
+                }
+                else if (strncmp(field, "SUBSYSTEM=", 10) == 0)
+                {
+                    subsystem = field + 10;
+                }
+                else if (strncmp(field, "DEVNAME=", 8) == 0)
+                {
+                    devname = field + 8;
+                }
+            }
+            if (strcmp(subsystem, "tty") != 0)
+            {
+                continue;
+            }
+            if (strcmp(action, "remove") == 0 && strncmp(hotplug.path, "/dev/", 5) == 0
+                && strcmp(hotplug.path + 5, devname) == 0)
+            {
+                port_lost(hotplug.generation);  // usually the reader noticed already
+                continue;
+            }
+            if (strcmp(action, "add") != 0 || !lost)
+            {
+                continue;
+            }
+        }
+        else if (!lost)
+        {
+            continue;
+        }
+        port_reopen(event_us);
+    }
+    return NULL;
+}
+
+// Function to remove the PARMRK marks from received bytes in place, returns the bytes left
+int link_unmark(char *data, int len)
+{
+    int out, i;
+    char *mark = (health.mark_state == 0) ? memchr(data, 0xFF, len) : data;
+    if (mark == NULL)
+    {
+        return len;  // the usual case: nothing marked, nothing to move
+    }
+    out = i = mark - data;
+    for (; i < len; i++)
+    {
+        unsigned char c = data[i];
+        switch (health.mark_state)
+        {
+            case 0:
+                if (c == 0xFF)
+                {
+                    health.mark_state = 1;
+                }
+                else
+                {
+                    data[out++] = c;
+                }
+                break;
+            case 1:
+                if (c == 0x00)
+                {
+                    health.mark_state = 2;
+                    break;
+                }
+                data[out++] = (char)0xFF;  // 0xFF 0xFF is one 0xFF
+                if (c != 0xFF)
+                {
+                    data[out++] = c;  // not a mark sequence, keep both bytes
+                }
+                health.mark_state = 0;
+                break;
+            default:
+                if (c == 0x00)
+                {
+                    health.marked_breaks++;
+                }
+                else
+                {
+                    health.marked_errors++;  // the byte is not what was sent, drop it
+                }
+                health.mark_state = 0;
+                break;
+        }
+    }
+    return out;
+}
+
+// Function to add the driver error counters since the last poll, returns 1 when one grew
+int link_icount_poll(void)
+{
+    struct serial_icounter_struct now;
+    int grew = 0;
+
+    if (ioctl(uart_fd, TIOCGICOUNT, &now) < 0)
+    {
+        return 0;  // ptys, some USB adapters, or the port is away
+    }
+    pthread_mutex_lock(&health.lock);
+    if (health.have_icount)
+    {
+        // a replugged adapter starts from zero again, its counts are all new
+        #define ICOUNT_ADD(total, field) \
+            do { int d = (now.field >= health.last.field) ? now.field - health.last.field : now.field; \
+                 total += d; grew |= (d > 0); } while (0)
+        ICOUNT_ADD(health.frame, frame);
+        ICOUNT_ADD(health.parity, parity);
+        ICOUNT_ADD(health.overrun, overrun);
+        ICOUNT_ADD(health.buf_overrun, buf_overrun);
+        ICOUNT_ADD(health.brk, brk);
+        #undef ICOUNT_ADD
+    }
+    health.have_icount = 1;  // the first poll is the baseline, errors from before we started do not count
+    health.last = now;
+    pthread_mutex_unlock(&health.lock);
+    return grew;
+}
+
+// Function to poll the error counters and the receive rate, warning when errors appear
+void* health_thread(void* arg)
+{
+    unsigned long long last_bytes = 0, last_marked = 0;
+
+    while (1)
+    {
+        int grew = link_icount_poll();
+        unsigned long long bytes = __atomic_load_n(&health.rx_bytes, __ATOMIC_RELAXED);
+        unsigned long long marked = __atomic_load_n(&health.marked_errors, __ATOMIC_RELAXED)
+                                    + __atomic_load_n(&health.marked_breaks, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&health.lock);
+        health.rate = (bytes - last_bytes) * 1000 / HEALTH_POLL_MS;
+        if (health.rate > health.rate_peak)
+        {
+            health.rate_peak = health.rate;
+        }
+        if (grew || marked != last_marked)
+        {
+            // at most one warning per interval, even when a wrong rate produces errors on every byte
+            port_notice("line", "%llu frame, %llu parity, %llu overrun, %llu buffer overrun, %llu break, "
+                        "%llu marked bytes at %llu B/s (totals)", health.frame, health.parity, health.overrun,
+                        health.buf_overrun, health.brk, marked, health.rate);
+        }
+        pthread_mutex_unlock(&health.lock);
+        last_bytes = bytes;
+        last_marked = marked;
+        usleep(HEALTH_POLL_MS * 1000);
+    }
+    return NULL;
+}
+
+// Function to read the driver count of transitions of one input line (index of modem_inputs)
+int modem_icount(const struct serial_icounter_struct *count, int input)
+{
+    const int counts[4] = { count->cts, count->dsr, count->rng, count->dcd };
+    return counts[input];
+}
+
+// Function to wait for changes of the input lines and publish each one as a capture event
+void* modem_thread(void* arg)
+{
+    struct serial_icounter_struct count_before, count_now;
+    int have_count = 0, before = 0, now;
+
+    while (1)
+    {
+        unsigned long long generation = __atomic_load_n(&hotplug.generation, __ATOMIC_RELAXED);
+        if (have_count == 0)
+        {
+            // (re)start: the state the next change is compared with
+            ioctl(uart_fd, TIOCMGET, &before);
+            have_count = (ioctl(uart_fd, TIOCGICOUNT, &count_before) == 0) ? 1 : -1;
+            pthread_mutex_lock(&modem.lock);
+            modem.lines = before;
+            pthread_mutex_unlock(&modem.lock);
+        }
+
+        // sleeps in the driver until one of the lines changes
+        if (ioctl(uart_fd, TIOCMIWAIT, MODEM_INPUTS) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (__atomic_load_n(&hotplug.lost, __ATOMIC_RELAXED) || errno == EIO)
+            {
+                port_lost(generation);
+                port_wait();
+                have_count = 0;
+                continue;
+            }
+            __atomic_store_n(&modem.supported, 0, __ATOMIC_RELAXED);  // ptys and some USB adapters
+            return NULL;
+        }
+        long long us = monotonic_us();
+        ioctl(uart_fd, TIOCMGET, &now);
+
+        // the line may have changed back before TIOCMGET: the driver counts every transition
+        char text[RX_SLAB_SIZE], stamp[64];
+        int len, transitions[4] = { 0 };
+        if (have_count > 0 && ioctl(uart_fd, TIOCGICOUNT, &count_now) == 0)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                transitions[i] = modem_icount(&count_now, i) - modem_icount(&count_before, i);
+            }
+            count_before = count_now;
+        }
+        format_stamp(us, stamp, sizeof(stamp));
+        int head = snprintf(text, sizeof(text), "[modem %s] ", stamp);
+        len = head - 1;
+        pthread_mutex_lock(&modem.lock);
+        for (int i = 0; i < 4; i++)
+        {
+            int changed = (now ^ before) & modem_inputs[i].bit;
+            if (changed || transitions[i] > 0)
+            {
+                modem.changes[i] += transitions[i] > 0 ? transitions[i] : 1;
+                len += snprintf(text + len, sizeof(text) - len, " %s %d->%d", modem_inputs[i].name,
+                                (before & modem_inputs[i].bit) != 0, (now & modem_inputs[i].bit) != 0);
+                if (transitions[i] > 1 || (!changed && transitions[i] > 0))
+                {
+                    len += snprintf(text + len, sizeof(text) - len, " (%d transitions)", transitions[i]);
+                }
+            }
+        }
+        modem.lines = now;
+        modem.last_us = us;
+        pthread_mutex_unlock(&modem.lock);
+        before = now;
+        if (len < head)
+        {
+            continue;  // woken without a change that is still visible
+        }
+
+        // into the ring like received data, so it lands between the bytes received around it
+        len += snprintf(text + len, sizeof(text) - len, "\n");
+        struct rx_slab *slab = rx_slab_alloc();
+        if (slab)
+        {
+            memcpy(slab->data, text, len + 1);
+            slab->len = len;
+            slab->rx_us = us;
+            slab->event = 1;
+            rx_publish(slab);
+        }
+        text[len - 1] = '\0';
+        port_notice("modem", "%s", text + head);
+    }
+    return NULL;
+}
+
+// Function to set, clear or pulse DTR or RTS (dtr/rts commands)
+void modem_command(int bit, const char *name, const char *arg)
+{
+    int pulse_us = 0, lines = 0;
+
+    if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)
+    {
+        if (ioctl(uart_fd, strcmp(arg, "on") == 0 ? TIOCMBIS : TIOCMBIC, &bit) < 0)
+        {
+            perror("Error setting modem line");
+            return;
+        }
+        printf("%s %s\n", name, arg);
+        return;
+    }
+    if (sscanf(arg, "pulse %d", &pulse_us) != 1 || pulse_us <= 0)
+    {
+        printf("usage: %s on|off|pulse <us>\n", name);
+        return;
+    }
+
+    // a pulse inverts the line and puts it back, timed against an absolute deadline: sleeping
+    // gets within the wakeup latency of the scheduler, the last MODEM_SPIN_US are spun
+    ioctl(uart_fd, TIOCMGET, &lines);
+    int first = (lines & bit) ? TIOCMBIC : TIOCMBIS;
+    if (ioctl(uart_fd, first, &bit) < 0)
+    {
+        perror("Error setting modem line");
+        return;
+    }
+    long long start = monotonic_us(), deadline = start + pulse_us;
+    if (pulse_us > MODEM_SPIN_US)
+    {
+        long long wake = deadline - MODEM_SPIN_US;
+        struct timespec at = { wake / 1000000, (wake % 1000000) * 1000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+        {
+        }
+    }
+    while (monotonic_us() < deadline)
+    {
+    }
+    ioctl(uart_fd, first == TIOCMBIC ? TIOCMBIS : TIOCMBIC, &bit);
+    long long end = monotonic_us();
+    printf("%s pulsed %s for %d us (%lld us between the two changes)\n", name,
+           first == TIOCMBIC ? "low" : "high", pulse_us, end - start);
+}
+
+// Function to show the modem lines and their changes (modem command)
+void print_modem(void)
+{
+    int lines = 0;
+    ioctl(uart_fd, TIOCMGET, &lines);
+    printf("DTR %d, RTS %d, CTS %d, DSR %d, RI %d, DCD %d\n", (lines & TIOCM_DTR) != 0, (lines & TIOCM_RTS) != 0,
+           (lines & TIOCM_CTS) != 0, (lines & TIOCM_DSR) != 0, (lines & TIOCM_RNG) != 0, (lines & TIOCM_CD) != 0);
+    pthread_mutex_lock(&modem.lock);
+    if (!__atomic_load_n(&modem.supported, __ATOMIC_RELAXED))
+    {
+        printf("line changes are not reported by this driver (no TIOCMIWAIT)\n");
+    }
+    else
+    {
+        printf("changes: CTS %llu, DSR %llu, RI %llu, DCD %llu\n",
+               modem.changes[0], modem.changes[1], modem.changes[2], modem.changes[3]);
+    }
+    pthread_mutex_unlock(&modem.lock);
+}
+
+// Function to make the calling thread the real time reader (--rt-priority, --rx-cpu)
+void reader_realtime(void)
+{
+    int len = snprintf(lowlat.reader, sizeof(lowlat.reader), "normal scheduling");
+    if (lowlat.rt_priority)
+    {
+        struct sched_param param = { .sched_priority = lowlat.rt_priority };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);  // needs CAP_SYS_NICE
+        if (err)
+        {
+            len = snprintf(lowlat.reader, sizeof(lowlat.reader), "SCHED_FIFO refused (%s)", strerror(err));
+            fprintf(stderr, "reader: %s\n", lowlat.reader);
+        }
+        else
+        {
+            len = snprintf(lowlat.reader, sizeof(lowlat.reader), "SCHED_FIFO %d", lowlat.rt_priority);
+        }
+    }
+    if (lowlat.rx_cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(lowlat.rx_cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err)
+        {
+            snprintf(lowlat.reader + len, sizeof(lowlat.reader) - len, ", CPU %d refused (%s)", lowlat.rx_cpu, strerror(err));
+            fprintf(stderr, "reader: can not run on CPU %d (%s)\n", lowlat.rx_cpu, strerror(err));
+        }
+        else
+        {
+            snprintf(lowlat.reader + len, sizeof(lowlat.reader) - len, ", on CPU %d", lowlat.rx_cpu);
+        }
+    }
+}
+
+// Function to look for the bench probe in the received data
+void rx_bench(struct rx_subscriber *sub, const char *data, int len)
+{
+    pthread_mutex_lock(&bench.lock);
+    for (int i = 0; i < len && bench.token_len; i++)
+    {
+        // the token starts with a character that does not occur in it again, no backtracking needed
+        if (data[i] == bench.token[bench.match])
+        {
+            bench.match++;
+        }
+        else
+        {
+            bench.match = (data[i] == bench.token[0]);
+        }
+        if (bench.match == bench.token_len)
+        {
+            bench.back_us = sub->slab_us;
+            bench.match = 0;
+            bench.token_len = 0;
+            pthread_cond_signal(&bench.back);
+        }
+    }
+    pthread_mutex_unlock(&bench.lock);
+}
+
+// Function to compare two round trip times for qsort
+int bench_compare(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to measure the round trip time of (count) probes (bench command)
+void bench_run(int count)
+{
+    if (count <= 0 || count > BENCH_MAX)
+    {
+        printf("usage: bench [count], at most %d probes\n", BENCH_MAX);
+        return;
+    }
+    if (tx_resume_running())  // the probes would end up in the receiver file
+    {
+        printf("transfer of %s still running\n", tx.bulk_name);
+        return;
+    }
+    long long *samples = malloc(count * sizeof(long long));
+    if (samples == NULL || rx_subscribe("bench", RX_POLICY_DROP, -1, rx_bench) == NULL)
+    {
+        free(samples);
+        return;
+    }
+
+    int done = 0, lost = 0;
+    for (int i = 0; i < count && !__atomic_load_n(&shut.stopping, __ATOMIC_RELAXED); i++)
+    {
+        pthread_mutex_lock(&bench.lock);
+        bench.token_len = snprintf(bench.token, sizeof(bench.token), "#bench%06d", i);
+        bench.match = 0;
+        bench.back_us = 0;
+        pthread_mutex_unlock(&bench.lock);
+
+        long long sent_us = monotonic_us();
+        write_uart_len(bench.token, bench.token_len);  // not queued behind the tx scheduler
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += BENCH_TIMEOUT_MS / 1000;
+        deadline.tv_nsec += (BENCH_TIMEOUT_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&bench.lock);
+        while (bench.back_us == 0 && pthread_cond_timedwait(&bench.back, &bench.lock, &deadline) == 0)
+        {
+        }
+        if (bench.back_us)
+        {
+            samples[done++] = bench.back_us - sent_us;
+        }
+        else
+        {
+            lost++;
+        }
+        bench.token_len = 0;
+        pthread_mutex_unlock(&bench.lock);
+    }
+    rx_unsubscribe("bench");
+
+    qsort(samples, done, sizeof(long long), bench_compare);
+    pthread_mutex_lock(&bench.lock);
+    bench.samples = done;
+    bench.lost = lost;
+    if (done)
+    {
+        bench.min_us = samples[0];
+        bench.p50_us = samples[done / 2];
+        bench.p90_us = samples[(done * 90) / 100];
+        bench.p99_us = samples[(done * 99) / 100];
+        bench.max_us = samples[done - 1];
+        bench.reader = busy.enabled ? "busy poll" : "blocking read";
+        memset(bench.histogram, 0, sizeof(bench.histogram));
+        for (int i = 0, bucket = 0; i < done; i++)
+        {
+            while (samples[i] >= bench_limits[bucket])
+            {
+                bucket++;  // samples are sorted
+            }
+            bench.histogram[bucket]++;
+        }
+        printf("bench: %d probes (%s reader), round trip min %lld us, median %lld us, p90 %lld us, p99 %lld us, max %lld us, %d lost\n",
+               done, bench.reader, bench.min_us, bench.p50_us, bench.p90_us, bench.p99_us, bench.max_us, lost);
+        for (int bucket = 0; bucket < BENCH_BUCKETS; bucket++)
+        {
+            if (bench.histogram[bucket])
+            {
+                char limit[24] = "more";
+                if (bench_limits[bucket] != INT_MAX)
+                {
+                    snprintf(limit, sizeof(limit), "< %d us", bench_limits[bucket]);
+                }
+                printf("  %-10s %6d %5.1f%%\n", limit, bench.histogram[bucket], 100.0 * bench.histogram[bucket] / done);
+            }
+        }
+    }
+    else
+    {
+        printf("bench: no probe came back in %d ms, the target has to echo (or use a loopback plug)\n",
+               BENCH_TIMEOUT_MS);
+    }
+    pthread_mutex_unlock(&bench.lock);
+    free(samples);
+}
+
+// Function to write data to the UART device (queued as interactive traffic)
+int write_uart(const char *data) 
+{
+    int len = strlen(data);
+    if (tx_submit_line(data, len) != E_OK)  // the scheduler keeps it ahead of bulk transfers
+    {
+        return -1;
+    }
+    return len;
+}
+
+// Function to write a binary buffer of known length to the UART device
+int write_uart_len(const char *data, int len)
+{
+    int written_on_uart = 0;
+    pthread_mutex_lock(&uart_lock);         // Lock the UART access to prevent race conditions
+    while (written_on_uart < len)           // the tty may accept less than requested
+    {
+        int ret = write(uart_fd, data + written_on_uart, len - written_on_uart);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            written_on_uart = -1;
+            break;
+        }
+        written_on_uart += ret;
+    }
+    pthread_mutex_unlock(&uart_lock);       // Unlock UART access
+    return written_on_uart;
+}
+
+// Function to print the prompt again with any partial user input
+void redraw_prompt(void)
+{
+    if (__atomic_load_n(&charmode.active, __ATOMIC_RELAXED) || __atomic_load_n(&shut.stopping, __ATOMIC_RELAXED))
+    {
+        return;  // the terminal belongs to the target, or we are leaving
+    }
+    printf(PROMPT);
+    pthread_mutex_lock(&prompt_lock);
+    edit_window = 0;
+    if (user_input_counter) // if there any uncompleted transmit
+    {
+        // a long line is not printed whole for every received line, only the screen around the cursor
+        struct winsize ws;
+        unsigned int room = 80 * 23 - PROMPT_LEN - 1, end = user_input_counter;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row > 1)
+        {
+            room = ws.ws_col * (ws.ws_row - 1) - PROMPT_LEN - 1;  // the row above stays, no wrap pending
+        }
+        if (user_input_counter > room)
+        {
+            end = edit_cursor > room / 2 ? edit_cursor - room / 2 + room : room;
+            end = end < user_input_counter ? end : user_input_counter;
+            edit_window = end - room;
+        }
+        printf("%.*s", (int)(end - edit_window), &user_input[edit_window]);  // Show any partial input
+        if (edit_cursor < end)
+        {
+            printf("\033[%uD", end - edit_cursor);  // back to where the user was editing
+        }
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    fflush(stdout);  // Ensure immediate output
+}
+
+// Function to remove the prompt and the typed text from the terminal, wrapped rows included
+void clear_prompt(void)
+{
+    struct winsize ws;
+    unsigned int row = 0;
+
+    if (__atomic_load_n(&charmode.active, __ATOMIC_RELAXED) || __atomic_load_n(&shut.stopping, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    pthread_mutex_lock(&prompt_lock);
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col)
+    {
+        // row of the cursor below the prompt row
+        row = (PROMPT_LEN + (edit_cursor > edit_window ? edit_cursor - edit_window : 0)) / ws.ws_col;
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    if (row)
+    {
+        printf("\033[%uA", row);
+    }
+    printf("\r\033[J");  // one sequence however long the line is
+}
+
+// Function to read the monotonic clock in milliseconds
+long long monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Function to read the monotonic clock in microseconds
+long long monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Function to update the rolling hash of a resumable transfer (64-bit FNV-1a)
+unsigned long long ckpt_hash(unsigned long long hash, const char *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;  // FNV 64-bit prime
+    }
+    return hash;
+}
+
+// Function to hash the first (length) bytes of a file
+StdReturn ckpt_hash_prefix(int fd, unsigned long long length, unsigned long long *hash)
+{
+    char block[CKPT_BLOCK];
+    unsigned long long done = 0;
+    *hash = 0xcbf29ce484222325ULL;  // FNV 64-bit offset basis
+
+    while (done < length)
+    {
+        int want = (length - done < CKPT_BLOCK) ? (int)(length - done) : CKPT_BLOCK;
+        int got = pread(fd, block, want, done);
+        if (got <= 0)
+        {
+            return E_NOK;  // file is shorter than the checkpoint
+        }
+        *hash = ckpt_hash(*hash, block, got);
+        done += got;
+    }
+    return E_OK;
+}
+
+// Function to store the checkpoint (offset + hash) of a resumable transfer
+StdReturn ckpt_save(struct rx_sink *sink)
+{
+    struct resume_rx *resume = &sink->resume;
+    char record[64];
+    // fixed width record so every checkpoint overwrites the previous one in place
+    int len = snprintf(record, sizeof(record), "%020llu %016llx\n", resume->offset, resume->hash);
+
+    if (fdatasync(sink->fd) < 0)  // the data must be on disk before the checkpoint claims it
+    {
+        perror("Error syncing destination file");
+        return E_NOK;
+    }
+    if (pwrite(resume->ckpt_fd, record, len, 0) != len)
+    {
+        perror("Error writing checkpoint file");
+        return E_NOK;
+    }
+    resume->ckpt_offset = resume->offset;
+    resume->ckpt_hash = resume->hash;
+    return E_OK;
+}
+
+// Function to feed one received byte to the control frame parser (returns 1 if it is plain data)
+int ctl_feed(struct rx_sink *sink, char c)
+{
+    if (ctl_frame_len < 0)  // outside a frame
+    {
+        if (c == CTL_SOF)
+        {
+            ctl_frame_len = 0;
+            return 0;
+        }
+        return 1;
+    }
+
+    if (c == CTL_EOF)  // frame complete
+    {
+        ctl_frame[ctl_frame_len] = '\0';
+        ctl_frame_len = -1;
+        ctl_dispatch(sink, ctl_frame);
+    }
+    else if (ctl_frame_len < CTL_MAX)
+    {
+        ctl_frame[ctl_frame_len++] = c;
+    }
+    else
+    {
+        ctl_frame_len = -1;  // too long to be a control frame, drop it
+    }
+    return 0;
+}
+
+// Function to handle a complete control frame
+void ctl_dispatch(struct rx_sink *sink, const char *frame)
+{
+    struct resume_rx *resume = &sink->resume;
+    char reply[CTL_MAX + 2];
+    unsigned long long offset, total, hash;
+
+    if (strcmp(frame, "RQ") == 0 && sink->kind == OUT_FLAG_RESUME && !resume->receiving)
+    {
+        // sender asks where to resume: answer with the last verified checkpoint
+        int len = snprintf(reply, sizeof(reply), "%cRA %llu %016llx%c", CTL_SOF, resume->offset, resume->hash, CTL_EOF);
+        write_uart_len(reply, len);
+    }
+    else if (sscanf(frame, "RS %llu %llu", &offset, &total) == 2 && sink->kind == OUT_FLAG_RESUME)
+    {
+        // sender starts the data phase, either from our checkpoint or from zero
+        if (offset != resume->offset)
+        {
+            resume->offset = 0;
+            resume->hash = 0xcbf29ce484222325ULL;
+        }
+        if (ftruncate(sink->fd, resume->offset) < 0)
+        {
+            perror("Error truncating destination file");
+        }
+        lseek(sink->fd, resume->offset, SEEK_SET);
+        if (resume->ckpt_fd < 0)  // a previous transfer completed and removed its checkpoint
+        {
+            resume->ckpt_fd = open(resume->ckpt_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        }
+        resume->total = total;
+        resume->receiving = (resume->offset < total);  // nothing left: only the RE frame follows
+        resume->verifying = !resume->receiving;
+        resume->last_rx = monotonic_ms();
+        clear_prompt();
+        printf("\033[0;32mReceived:\033[0m resuming at %llu of %llu bytes\n", resume->offset, resume->total);
+        redraw_prompt();
+    }
+    else if (sscanf(frame, "RE %llx", &hash) == 1 && sink->kind == OUT_FLAG_RESUME && resume->verifying)
+    {
+        // the sender hash of the whole file: the checkpoints only prove the bytes were stored as received
+        resume->verifying = 0;
+        clear_prompt();
+        if (hash == resume->hash)
+        {
+            printf("\033[0;32mReceived:\033[0m transfer complete, %llu bytes, hash %016llx verified\n", resume->total, hash);
+        }
+        else
+        {
+            printf("\033[0;31mReceived:\033[0m %llu bytes but the hash does not match the sender (%016llx, %016llx expected), "
+                   "the file is discarded\n", resume->total, resume->hash, hash);
+            if (ftruncate(sink->fd, 0) < 0)
+            {
+                perror("Error truncating destination file");
+            }
+            lseek(sink->fd, 0, SEEK_SET);
+        }
+        unlink(resume->ckpt_path);  // done either way, a new T<< starts from the first byte
+        close(resume->ckpt_fd);
+        resume->ckpt_fd = -1;
+        resume->offset = resume->ckpt_offset = 0;
+        resume->hash = resume->ckpt_hash = 0xcbf29ce484222325ULL;
+        redraw_prompt();
+    }
+    else if (strncmp(frame, "RA ", 3) == 0 && ctl_awaiting_offer)
+    {
+        // receiver offer for the T<< waiting in write_thread
+        pthread_mutex_lock(&ctl_lock);
+        strcpy(ctl_reply, frame);
+        ctl_reply_ready = 1;
+        pthread_cond_signal(&ctl_cond);
+        pthread_mutex_unlock(&ctl_lock);
+    }
+}
+
+// Function to open a resumable destination file and restore its last checkpoint (R>>file)
+StdReturn resume_receive_open(const char *file)
+{
+    char record[64] = {0};
+
+    int fd = open(file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);  // no O_TRUNC, old data may be reused
+    if (fd == -1)
+    {
+        perror("Error opening destination file\n");
+        return E_NOK;
+    }
+    struct rx_sink *sink = rx_sink_new(OUT_FLAG_RESUME, fd, file);
+    if (sink == NULL)
+    {
+        close(fd);
+        return E_NOK;
+    }
+    struct resume_rx *resume = &sink->resume;  // not published yet, the reader can not see it
+
+    snprintf(resume->ckpt_path, sizeof(resume->ckpt_path), "%s%s", file, CKPT_SUFFIX);
+    resume->ckpt_fd = open(resume->ckpt_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (resume->ckpt_fd == -1)
+    {
+        perror("Error opening checkpoint file\n");
+        close(fd);
+        free(sink);
+        return E_NOK;
+    }
+
+    if (pread(resume->ckpt_fd, record, sizeof(record) - 1, 0) > 0)
+    {
+        unsigned long long offset, hash, check;
+        // only trust the checkpoint if the file still holds exactly the hashed bytes
+        if (sscanf(record, "%llu %llx", &offset, &hash) == 2
+            && ckpt_hash_prefix(fd, offset, &check) == E_OK && check == hash)
+        {
+            resume->offset = offset;
+            resume->hash = hash;
+        }
+    }
+
+    // drop anything written after the last verified block
+    resume->ckpt_offset = resume->offset;
+    resume->ckpt_hash = resume->hash;
+    if (ftruncate(fd, resume->offset) < 0)
+    {
+        perror("Error truncating destination file");
+    }
+    lseek(fd, resume->offset, SEEK_SET);
+
+    rx_sink_switch(sink);  // closes the previous destination and its checkpoint file
+    printf("Redirection : to %s (resumable, %llu bytes verified)\n", file, resume->offset);
+    return E_OK;
+}
+
+// Function to consume received bytes while a resumable destination is active
+void resume_receive(struct rx_sink *sink, const char *buf, int len)
+{
+    struct resume_rx *resume = &sink->resume;
+    int i = 0;
+
+    if (resume->receiving && monotonic_ms() - resume->last_rx > RESUME_STALL)
+    {
+        // the sender went away mid transfer: roll back to the last checkpoint and
+        // treat the new bytes as a fresh negotiation
+        resume->receiving = 0;
+        resume->offset = resume->ckpt_offset;
+        resume->hash = resume->ckpt_hash;
+        if (ftruncate(sink->fd, resume->offset) < 0)
+        {
+            perror("Error truncating destination file");
+        }
+        lseek(sink->fd, resume->offset, SEEK_SET);
+    }
+    resume->last_rx = monotonic_ms();
+
+    while (i < len)
+    {
+        if (!resume->receiving)
+        {
+            ctl_feed(sink, buf[i++]);  // only negotiation frames are expected here
+            continue;
+        }
+
+        // write up to the end of the transfer or the next checkpoint boundary
+        unsigned long long to_block = CKPT_BLOCK - (resume->offset % CKPT_BLOCK);
+        unsigned long long left = resume->total - resume->offset;
+        int n = len - i;
+        if ((unsigned long long)n > to_block)
+        {
+            n = to_block;
+        }
+        if ((unsigned long long)n > left)
+        {
+            n = left;
+        }
+
+        if (write(sink->fd, buf + i, n) != n)
+        {
+            perror("Error writing to destination file\n");
+            resume->receiving = 0;  // checkpoint still points to the last good block
+            return;
+        }
+        resume->hash = ckpt_hash(resume->hash, buf + i, n);
+        resume->offset += n;
+        i += n;
+
+        if (resume->offset == resume->total)
+        {
+            ckpt_save(sink);            // an RE frame lost on the way can be asked for again with T<<
+            resume->receiving = 0;
+            resume->verifying = 1;      // the RE frame tells whether these are the bytes that were sent
+        }
+        else if (resume->offset % CKPT_BLOCK == 0)
+        {
+            ckpt_save(sink);
+        }
+    }
+}
+
+// Function to create a sink for the shell view or a destination file
+struct rx_sink* rx_sink_new(char kind, int fd, const char *name)
+{
+    struct rx_sink *sink = calloc(1, sizeof(*sink));
+    if (sink == NULL)
+    {
+        perror("Error allocating receive sink");
+        return NULL;
+    }
+    sink->kind = kind;
+    sink->fd = fd;
+    snprintf(sink->name, sizeof(sink->name), "%s", name);
+    sink->resume.ckpt_fd = -1;
+    sink->resume.hash = sink->resume.ckpt_hash = 0xcbf29ce484222325ULL;
+    return sink;
+}
+
+// Function to make (sink) the destination of received data, the old one is closed once unused
+void rx_sink_switch(struct rx_sink *sink)
+{
+    struct rx_sink *old = __atomic_exchange_n(&port.sink, sink, __ATOMIC_SEQ_CST);
+    unsigned long long epoch = __atomic_load_n(&port.epoch, __ATOMIC_SEQ_CST);
+
+    // grace period: a delivery that started before the swap may still write to the old sink,
+    // wait until it is over. the next delivery already loads the new sink, no byte is lost
+    while ((epoch & 1) && __atomic_load_n(&port.epoch, __ATOMIC_SEQ_CST) == epoch)
+    {
+        usleep(100);
+    }
+    if (old)
+    {
+        if (old->fd >= 0)
+        {
+            close(old->fd);
+        }
+        if (old->resume.ckpt_fd >= 0)
+        {
+            close(old->resume.ckpt_fd);  // keep the checkpoint file for a later R>>
+        }
+        free(old);
+        __atomic_add_fetch(&port.switches, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Function to take the current sink, it stays valid until rx_sink_leave() (shell subscriber only)
+struct rx_sink* rx_sink_enter(void)
+{
+    __atomic_add_fetch(&port.epoch, 1, __ATOMIC_SEQ_CST);  // odd: a switch waits for us
+    return __atomic_load_n(&port.sink, __ATOMIC_SEQ_CST);
+}
+
+// Function to tell writers the reader no longer holds a sink
+void rx_sink_leave(void)
+{
+    __atomic_add_fetch(&port.epoch, 1, __ATOMIC_RELEASE);
+}
+
+// Function to transmit a file resuming from the receiver last checkpoint (T<<file)
+StdReturn resume_transmit(const char *file)
+{
+    char frame[CTL_MAX + 2];
+    unsigned long long offset = 0, hash = 0, check, total;
+    struct stat st;
+    struct timespec deadline;
+    int ret = 0, len;
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Error opening source file\n");
+        return E_NOK;
+    }
+    fstat(fd, &st);
+    total = st.st_size;
+
+    // the receiver counts the data bytes: from RQ to the last byte nothing else may reach the UART.
+    // lines queued before T<< go first, the ones typed meanwhile wait for the end of the file
+    pthread_mutex_lock(&tx.lock);
+    if (tx.bulk_fd >= 0 || tx.exclusive)  // negotiation frames would land in the middle of the running file
+    {
+        printf("transfer of %s still running\n", tx.bulk_name);
+        pthread_mutex_unlock(&tx.lock);
+        close(fd);
+        return E_NOK;
+    }
+    tx.exclusive = 1;
+    snprintf(tx.bulk_name, sizeof(tx.bulk_name), "%s", file);
+    while (tx.line_count || tx.sending || tx.direct)
+    {
+        pthread_cond_wait(&tx.room, &tx.lock);
+    }
+    pthread_mutex_unlock(&tx.lock);
+
+    // ask the receiver for its last verified checkpoint
+    pthread_mutex_lock(&ctl_lock);
+    ctl_reply_ready = 0;
+    ctl_awaiting_offer = 1;
+    pthread_mutex_unlock(&ctl_lock);
+    len = snprintf(frame, sizeof(frame), "%cRQ%c", CTL_SOF, CTL_EOF);
+    write_uart_len(frame, len);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RESUME_TIMEOUT;
+    pthread_mutex_lock(&ctl_lock);
+    while (!ctl_reply_ready && ret == 0)
+    {
+        ret = pthread_cond_timedwait(&ctl_cond, &ctl_lock, &deadline);
+    }
+    ctl_awaiting_offer = 0;
+    if (ctl_reply_ready)
+    {
+        sscanf(ctl_reply, "RA %llu %llx", &offset, &hash);
+    }
+    pthread_mutex_unlock(&ctl_lock);
+
+    if (ret != 0)
+    {
+        printf("\033[0;31msent->\033[0mno resume offer from receiver (is it in R>> mode?)\n");
+        close(fd);
+        pthread_mutex_lock(&tx.lock);
+        tx.exclusive = 0;
+        pthread_cond_broadcast(&tx.room);
+        pthread_cond_signal(&tx.wake);  // the held lines go out now
+        pthread_mutex_unlock(&tx.lock);
+        return E_NOK;
+    }
+
+    // resume only if our file starts with exactly the bytes the receiver holds
+    if (offset > total || ckpt_hash_prefix(fd, offset, &check) != E_OK || check != hash)
+    {
+        offset = 0;
+        hash = 0xcbf29ce484222325ULL;  // FNV 64-bit offset basis
+    }
+    pthread_mutex_lock(&tx.lock);
+    tx.bulk_hash = hash;  // continued over the data phase for the RE frame
+    pthread_mutex_unlock(&tx.lock);
+    len = snprintf(frame, sizeof(frame), "%cRS %llu %llu%c", CTL_SOF, offset, total, CTL_EOF);
+    write_uart_len(frame, len);
+
+    printf("\033[0;31msent->\033[0mresuming %s at %llu of %llu bytes\n", file, offset, total);
+    return tx_submit_file(fd, file, offset, total);  // the data phase runs as the bulk class, tx_thread ends it
+}
+
+// Function to queue an interactive message, it goes out before the next bulk slice
+StdReturn tx_submit_line(const char *data, int len)
+{
+    if (scroll.size)
+    {
+        int text_len = len;
+        while (text_len && (data[text_len - 1] == '\n' || data[text_len - 1] == '\r'))
+        {
+            text_len--;
+        }
+        scroll_add(SCROLL_TX, data, text_len, monotonic_us());
+    }
+
+    // a long line is streamed: each piece is queued as soon as the scheduler took an earlier one,
+    // so it never needs more memory than the queue and stays ahead of bulk slices
+    do
+    {
+        int piece = len < BUF_SIZE ? len : BUF_SIZE;
+        tx_enqueue(data, piece);
+        data += piece;
+        len -= piece;
+    } while (len > 0);
+    return E_OK;
+}
+
+// Function to queue one piece of at most BUF_SIZE bytes, waiting for room in the queue
+void tx_enqueue(const char *data, int len)
+{
+    pthread_mutex_lock(&tx.lock);
+    while (tx.line_count == TX_LINES)
+    {
+        pthread_cond_wait(&tx.room, &tx.lock);
+    }
+    struct tx_line *line = &tx.lines[(tx.line_head + tx.line_count) % TX_LINES];
+    memcpy(line->data, data, len);
+    line->len = len;
+    line->queued_us = monotonic_us();
+    tx.line_count++;
+    pthread_cond_signal(&tx.wake);
+    pthread_mutex_unlock(&tx.lock);
+}
+
+// Function to hand a file to the scheduler as the bulk transfer, starting at (offset)
+StdReturn tx_submit_file(int fd, const char *name, unsigned long long offset, unsigned long long total)
+{
+    pthread_mutex_lock(&tx.lock);
+    if (tx.bulk_fd >= 0)
+    {
+        pthread_mutex_unlock(&tx.lock);
+        printf("transfer of %s still running\n", tx.bulk_name);
+        return E_NOK;
+    }
+    lseek(fd, offset, SEEK_SET);
+    tx.bulk_fd = fd;
+    snprintf(tx.bulk_name, sizeof(tx.bulk_name), "%s", name);
+    tx.bulk_sent = offset;
+    tx.bulk_total = total;
+    pthread_cond_signal(&tx.wake);
+    pthread_mutex_unlock(&tx.lock);
+    return E_OK;
+}
+
+// Function to tell whether a T<< owns the UART, nothing may be written between its bytes then
+int tx_resume_running(void)
+{
+    pthread_mutex_lock(&tx.lock);
+    int running = tx.exclusive;
+    pthread_mutex_unlock(&tx.lock);
+    return running;
+}
+
+// Function to start a write that bypasses the queue, waiting while a T<< owns the UART (returns 1 if it waited)
+int tx_direct_begin(void)
+{
+    int waited = 0;
+
+    pthread_mutex_lock(&tx.lock);
+    while (tx.exclusive)
+    {
+        pthread_cond_wait(&tx.room, &tx.lock);
+        waited = 1;
+    }
+    tx.direct++;  // a T<< starting now waits for this write before its RQ
+    pthread_mutex_unlock(&tx.lock);
+    return waited;
+}
+
+// Function to end a write started with tx_direct_begin()
+void tx_direct_end(void)
+{
+    pthread_mutex_lock(&tx.lock);
+    tx.direct--;
+    pthread_cond_broadcast(&tx.room);
+    pthread_mutex_unlock(&tx.lock);
+}
+
+// Function to write queued data to the UART, interactive class first, bulk in slices
+void* tx_thread(void* arg)
+{
+    char slice[TX_SLICE];
+
+    pthread_mutex_lock(&tx.lock);
+    while (1)
+    {
+        if (tx.line_count && !tx.exclusive)
+        {
+            // interactive class: the whole line goes out right away
+            struct tx_line line = tx.lines[tx.line_head];
+            tx.line_head = (tx.line_head + 1) % TX_LINES;
+            tx.line_count--;
+            tx.sending = 1;
+            pthread_cond_broadcast(&tx.room);
+            pthread_mutex_unlock(&tx.lock);
+
+            int ahead = 0;
+            ioctl(uart_fd, TIOCOUTQ, &ahead);  // bulk bytes the line still waits behind
+            write_uart_len(line.data, line.len);
+            long long latency = monotonic_us() - line.queued_us;
+
+            pthread_mutex_lock(&tx.lock);
+            tx.sending = 0;
+            pthread_cond_broadcast(&tx.room);  // a T<< waits for the line before its RQ
+            tx.lines_sent++;
+            tx.latency_sum_us += latency;
+            if (latency > tx.latency_max_us)
+            {
+                tx.latency_max_us = latency;
+            }
+            if (ahead > tx.ahead_max)
+            {
+                tx.ahead_max = ahead;
+            }
+        }
+        else if (tx.bulk_fd >= 0 && __atomic_load_n(&shut.stopping, __ATOMIC_RELAXED))
+        {
+            // leaving: the rest of the file is not pending data, T<< can resume it later
+            printf("transfer of %s stopped at %llu/%llu bytes\n", tx.bulk_name, tx.bulk_sent, tx.bulk_total);
+            close(tx.bulk_fd);
+            tx.bulk_fd = -1;
+            tx.exclusive = 0;
+            pthread_cond_broadcast(&tx.room);
+        }
+        else if (tx.bulk_fd >= 0)
+        {
+            // bulk class: only refill the driver when it holds less than one slice,
+            // so a line typed now waits for one slice time at most
+            int queued = 0;
+            ioctl(uart_fd, TIOCOUTQ, &queued);
+            if (queued > TX_SLICE)
+            {
+                struct timespec wait;
+                clock_gettime(CLOCK_REALTIME, &wait);
+                wait.tv_nsec += 1000000;  // recheck in 1ms unless a line arrives first
+                if (wait.tv_nsec >= 1000000000)
+                {
+                    wait.tv_sec++;
+                    wait.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&tx.wake, &tx.lock, &wait);
+                continue;
+            }
+
+            int fd = tx.bulk_fd;
+            pthread_mutex_unlock(&tx.lock);
+            int n = read(fd, slice, TX_SLICE);
+            int written = (n > 0) ? write_uart_len(slice, n) : n;
+            pthread_mutex_lock(&tx.lock);
+
+            if (written > 0)
+            {
+                tx.bulk_sent += written;
+                tx.bulk_bytes += written;
+                tx.bulk_slices++;
+                if (tx.exclusive)
+                {
+                    tx.bulk_hash = ckpt_hash(tx.bulk_hash, slice, written);
+                }
+            }
+            if (written <= 0 || tx.bulk_sent >= tx.bulk_total)
+            {
+                int done = (tx.bulk_sent >= tx.bulk_total);
+                unsigned long long total = tx.bulk_total;
+                char name[BUF_SIZE];
+                strcpy(name, tx.bulk_name);
+                close(tx.bulk_fd);
+                tx.bulk_fd = -1;
+                if (done && tx.exclusive)
+                {
+                    // T<<: the receiver compares the hash of the whole file, still before any held line
+                    char frame[CTL_MAX + 2];
+                    int len = snprintf(frame, sizeof(frame), "%cRE %016llx%c", CTL_SOF, tx.bulk_hash, CTL_EOF);
+                    write_uart_len(frame, len);
+                }
+                tx.exclusive = 0;  // the held lines go out from the next turn on
+                pthread_cond_broadcast(&tx.room);
+                pthread_mutex_unlock(&tx.lock);
+
+                clear_prompt();
+                if (done)
+                {
+                    // Print the sent-> x bytes transmited from y success
+                    printf("\033[0;31msent->\033[0m%llu bytes transmited from %s success\n", total, name);
+                }
+                else
+                {
+                    perror("Error transmitting file\n");
+                }
+                redraw_prompt();
+                pthread_mutex_lock(&tx.lock);
+            }
+        }
+        else
+        {
+            pthread_cond_wait(&tx.wake, &tx.lock);  // nothing to send
+        }
+    }
+    return NULL;
+}
+
+// Function to print the runtime statistics (stats command)
+void print_stats(void)
+{
+    pthread_mutex_lock(&tx.lock);
+    printf("tx interactive : %llu lines, latency avg %lld us, max %lld us, max %d bytes queued ahead\n",
+           tx.lines_sent, tx.lines_sent ? tx.latency_sum_us / (long long)tx.lines_sent : 0,
+           tx.latency_max_us, tx.ahead_max);
+    printf("tx bulk        : %llu bytes in %llu slices of %d bytes (slice time %d us)\n",
+           tx.bulk_bytes, tx.bulk_slices, TX_SLICE, uart_baud ? TX_SLICE * 10 * 1000000 / uart_baud : 0);
+    if (tx.bulk_fd >= 0)
+    {
+        printf("tx running     : %s %llu/%llu bytes\n", tx.bulk_name, tx.bulk_sent, tx.bulk_total);
+    }
+    pthread_mutex_unlock(&tx.lock);
+
+    pthread_mutex_lock(&rx.lock);
+    for (int i = 0; i < RX_SUBSCRIBERS; i++)
+    {
+        struct rx_subscriber *sub = &rx.subs[i];
+        if (sub->used)
+        {
+            printf("rx %-12s: %llu bytes, %llu slabs behind, %llu slabs dropped (%s)\n",
+                   sub->name, sub->bytes, rx.head - sub->cursor, sub->drops,
+                   sub->policy == RX_POLICY_DROP ? "drop" : "block");
+        }
+    }
+    pthread_mutex_unlock(&rx.lock);
+    // only this thread replaces the sink, it can not be freed under us
+    printf("rx sink        : %s, %llu switches\n", port.sink->name, __atomic_load_n(&port.switches, __ATOMIC_RELAXED));
+    pthread_mutex_lock(&hotplug.lock);
+    printf("port           : %s%s, lost %llu times, reopened %llu times (worst %lld us after the uevent)\n",
+           hotplug.path, hotplug.lost ? " (lost)" : "", hotplug.losses, hotplug.reopens, hotplug.reopen_max_us);
+    pthread_mutex_unlock(&hotplug.lock);
+    pthread_mutex_lock(&health.lock);
+    printf("line           : rx %llu bytes, %llu B/s (peak %llu B/s), marked %llu error bytes, %llu breaks\n",
+           health.rx_bytes, health.rate, health.rate_peak, health.marked_errors, health.marked_breaks);
+    if (health.have_icount)
+    {
+        printf("line driver    : %llu frame, %llu parity, %llu overrun, %llu buffer overrun, %llu break\n",
+               health.frame, health.parity, health.overrun, health.buf_overrun, health.brk);
+    }
+    else
+    {
+        printf("line driver    : no error counters (TIOCGICOUNT not supported)\n");
+    }
+    pthread_mutex_unlock(&health.lock);
+    if (lowlat.enabled)
+    {
+        char timer[64] = "no latency_timer";
+        if (lowlat.timer_was >= 0)
+        {
+            snprintf(timer, sizeof(timer), "latency_timer %d ms (was %d ms)", lowlat.timer_now, lowlat.timer_was);
+        }
+        printf("low latency    : ASYNC_LOW_LATENCY %s, %s, reader %s\n",
+               lowlat.serial_now ? "set" : lowlat.serial_was < 0 ? "not supported" : "refused", timer, lowlat.reader);
+    }
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.started)
+    {
+        unsigned long long requests = 0, errors = 0, timeouts = 0;
+        for (int i = 0; i < rpc.key_count; i++)
+        {
+            requests += rpc.keys[i].count;
+            errors += rpc.keys[i].errors;
+            timeouts += rpc.keys[i].timeouts;
+        }
+        printf("rpc            : %llu requests, %d outstanding of %d, %llu errors, %llu timeouts (rpc shows them per command)\n",
+               requests, rpc.outstanding, rpc.depth, errors, timeouts);
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    pthread_mutex_lock(&bench.lock);
+    if (bench.samples)
+    {
+        printf("bench          : %d probes (%s reader), round trip min %lld us, median %lld us, p90 %lld us, p99 %lld us, max %lld us, %d lost\n",
+               bench.samples, bench.reader, bench.min_us, bench.p50_us, bench.p90_us, bench.p99_us, bench.max_us, bench.lost);
+    }
+    pthread_mutex_unlock(&bench.lock);
+    if (busy.enabled)
+    {
+        // written by the reader only, a torn read costs a wrong digit in the stats
+        long long running_us = monotonic_us() - start_us;
+        printf("busy reader    : %llu reads with data, %llu empty, %llu yields, throttled in %llu windows, %lld%% of a CPU (budget %d%%)\n",
+               busy.reads, busy.empty, busy.yields, busy.throttled,
+               running_us ? busy.cpu_us * 100 / running_us : 0, busy.budget);
+    }
+
+    // times since main() was entered, a step that did not happen yet shows as "-"
+    char first_rx[32] = "-", triggers[32] = "-";
+    long long first_rx_us = __atomic_load_n(&startup.first_rx_us, __ATOMIC_RELAXED);
+    if (first_rx_us)
+    {
+        snprintf(first_rx, sizeof(first_rx), "%lld us", first_rx_us - startup.main_us);
+    }
+    if (__atomic_load_n(&trig.ready, __ATOMIC_ACQUIRE))
+    {
+        snprintf(triggers, sizeof(triggers), "%lld us", startup.triggers_us - startup.main_us);
+    }
+    printf("startup        : options %lld us, port open %lld us, first byte %s, triggers ready %s\n",
+           startup.options_us - startup.main_us, startup.open_us - startup.main_us,
+           first_rx, trigger_file ? triggers : "(none)");
+
+    if (charmode.keys)
+    {
+        printf("char mode      : %llu keys (%llu bytes), key to wire avg %lld us, max %lld us\n",
+               charmode.keys, charmode.bytes, charmode.latency_sum_us / (long long)charmode.keys,
+               charmode.latency_max_us);
+    }
+
+    pthread_mutex_lock(&rx_pool.lock);
+    printf("rx slab pool   : %llu slabs in %llu allocations, %d free, %llu batches out, %llu back\n",
+           rx_pool.chunks * RX_POOL_CHUNK, rx_pool.chunks, rx_pool.free_count, rx_pool.refills, rx_pool.returns);
+    pthread_mutex_unlock(&rx_pool.lock);
+}
+
+// Function to compute the CRC-8 (poly 0x07) of a multiplexed frame
+unsigned char mux_crc8(const unsigned char *data, int len)
+{
+    unsigned char crc = 0;
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Function to create one pty per virtual channel
+StdReturn mux_open(void)
+{
+    for (int ch = 0; ch < MUX_CHANNELS; ch++)
+    {
+        struct termios raw;
+        mux[ch].master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (mux[ch].master_fd < 0 || grantpt(mux[ch].master_fd) < 0 || unlockpt(mux[ch].master_fd) < 0)
+        {
+            perror("Error creating channel pty");
+            return E_NOK;
+        }
+
+        // hold the slave open so the master does not report hangup while no client is attached
+        mux[ch].slave_fd = open(ptsname(mux[ch].master_fd), O_RDWR | O_NOCTTY);
+        if (mux[ch].slave_fd < 0)
+        {
+            perror("Error opening channel pty");
+            return E_NOK;
+        }
+        tcgetattr(mux[ch].slave_fd, &raw);
+        cfmakeraw(&raw);  // channel bytes pass unmodified, line editing belongs to the target
+        tcsetattr(mux[ch].slave_fd, TCSANOW, &raw);
+
+        printf("channel %d (%s) -> %s\n", ch, mux[ch].name, ptsname(mux[ch].master_fd));
+    }
+    fflush(stdout);
+    return E_OK;
+}
+
+// Function to send one payload as a frame on a virtual channel
+int mux_send(int channel, const char *data, int len)
+{
+    unsigned char frame[MUX_HDR + MUX_PAYLOAD + 1];
+
+    frame[0] = MUX_SOF;
+    frame[1] = channel;
+    frame[2] = len;
+    memcpy(&frame[MUX_HDR], data, len);
+    frame[MUX_HDR + len] = mux_crc8(&frame[1], len + 2);  // covers channel, length and payload
+
+    mux[channel].tx_frames++;
+    return write_uart_len((const char *)frame, MUX_HDR + len + 1);
+}
+
+// Function to split received bytes into frames and deliver them to the channel ptys
+void mux_demux(const char *buf, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        switch (mux_rx.state)
+        {
+            case 0:  // hunting for the start of a frame
+                if (c == MUX_SOF)
+                {
+                    mux_rx.state = 1;
+                }
+                break;
+            case 1:
+                mux_rx.channel = c;
+                mux_rx.state = (c < MUX_CHANNELS) ? 2 : 0;
+                break;
+            case 2:
+                mux_rx.length = c;
+                mux_rx.got = 0;
+                mux_rx.state = (c > 0 && c <= MUX_PAYLOAD) ? 3 : 0;
+                break;
+            case 3:
+                mux_rx.payload[mux_rx.got++] = c;
+                if (mux_rx.got == mux_rx.length)
+                {
+                    mux_rx.state = 4;
+                }
+                break;
+            case 4:
+            {
+                unsigned char hdr[2 + MUX_PAYLOAD];
+                hdr[0] = mux_rx.channel;
+                hdr[1] = mux_rx.length;
+                memcpy(&hdr[2], mux_rx.payload, mux_rx.length);
+                mux_rx.state = 0;
+
+                if (mux_crc8(hdr, mux_rx.length + 2) != c)
+                {
+                    mux_rx.crc_errors++;  // resynchronise on the next SOF
+                    break;
+                }
+
+                struct mux_channel *chan = &mux[mux_rx.channel];
+                int written = write(chan->master_fd, mux_rx.payload, mux_rx.length);  // non-blocking pty
+                if (written < 0)
+                {
+                    written = 0;
+                }
+                chan->rx_bytes += written;
+                chan->rx_drops += mux_rx.length - written;  // a slow reader never stalls the other channels
+                break;
+            }
+        }
+    }
+}
+
+// Function to forward local channel data to the UART, highest priority channel first
+void* mux_thread(void* arg)
+{
+    struct pollfd fds[MUX_CHANNELS];
+    char payload[MUX_PAYLOAD];
+    int held[MUX_CHANNELS] = {0};   // channels waiting for the driver queue to drain
+
+    while (1)
+    {
+        int any_held = 0;
+        for (int ch = 0; ch < MUX_CHANNELS; ch++)
+        {
+            fds[ch].fd = mux[ch].master_fd;
+            fds[ch].events = held[ch] ? 0 : POLLIN;
+            any_held |= held[ch];
+        }
+
+        // held channels are rechecked every millisecond, everything else wakes us immediately
+        if (poll(fds, MUX_CHANNELS, any_held ? 1 : -1) < 0 && errno != EINTR)
+        {
+            perror("Error polling channels");
+            return NULL;
+        }
+
+        int queued = 0;
+        ioctl(uart_fd, TIOCOUTQ, &queued);  // bytes still waiting in the UART driver
+        for (int ch = 0; ch < MUX_CHANNELS; ch++)
+        {
+            held[ch] = 0;
+        }
+
+        for (int ch = 0; ch < MUX_CHANNELS; ch++)
+        {
+            int was_held = (fds[ch].events == 0);  // not polled, may still have data
+            if (!(fds[ch].revents & POLLIN) && !was_held)
+            {
+                continue;
+            }
+
+            // lower priorities may not fill the driver queue, so a console keystroke
+            // never waits behind more than a couple of bulk frames
+            if (ch != 0 && queued > MUX_TXQ_LIMIT)
+            {
+                held[ch] = 1;
+                continue;
+            }
+
+            int n = read(mux[ch].master_fd, payload, MUX_PAYLOAD);
+            if (n > 0)
+            {
+                mux_send(ch, payload, n);
+                break;  // poll again so a higher priority channel goes next
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to open the TCP listener of the network bridge
+StdReturn net_open(void)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    for (int i = 0; i < NET_CLIENTS; i++)
+    {
+        net.clients[i].fd = -1;
+    }
+
+    net.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (net.listen_fd < 0)
+    {
+        perror("Error creating socket");
+        return E_NOK;
+    }
+    setsockopt(net.listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(net.port);
+    if (bind(net.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(net.listen_fd, NET_CLIENTS) < 0)
+    {
+        perror("Error listening on TCP port");
+        return E_NOK;
+    }
+
+    net.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (net.wake_fd < 0)
+    {
+        perror("Error creating eventfd");
+        return E_NOK;
+    }
+
+    printf("bridging to TCP port %d (%s)\n", net.port, net.rfc2217 ? "RFC 2217" : "raw");
+    fflush(stdout);
+    return E_OK;
+}
+
+// Function to queue received UART data for every connected client
+void net_broadcast(const char *buf, int len)
+{
+    unsigned long long one = 1;
+
+    pthread_mutex_lock(&net.lock);
+    for (int i = 0; i < NET_CLIENTS; i++)
+    {
+        if (net.clients[i].fd >= 0)
+        {
+            net_queue(&net.clients[i], (const unsigned char *)buf, len);
+        }
+    }
+    pthread_mutex_unlock(&net.lock);
+
+    // data that arrives while the loop is still sending piles up and leaves in one send
+    if (write(net.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("Error waking network bridge");
+    }
+}
+
+// Function to append bytes to a client output buffer (telnet clients get 0xFF doubled)
+void net_queue(struct net_client *client, const unsigned char *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        int need = (net.rfc2217 && data[i] == TELNET_IAC) ? 2 : 1;
+        if (client->out_len + need > NET_BUF)
+        {
+            client->drops += len - i;  // a stalled client must not hold back the UART
+            return;
+        }
+        if (need == 2)
+        {
+            client->out[client->out_len++] = (char)TELNET_IAC;
+        }
+        client->out[client->out_len++] = data[i];
+    }
+}
+
+// Function to answer a telnet option request once
+void net_option(struct net_client *client, unsigned char verb, unsigned char option)
+{
+    int accepted = (option == TELNET_BINARY || option == TELNET_SGA || option == TELNET_COMPORT);
+    int side = (verb == TELNET_WILL || verb == TELNET_WONT) ? 1 : 0;  // a WILL is answered by DO
+    unsigned char reply[3] = { TELNET_IAC, 0, option };
+
+    if (client->acked[side][option / 8] & (1 << (option % 8)))
+    {
+        return;  // already answered, replying again would start an option loop
+    }
+    client->acked[side][option / 8] |= 1 << (option % 8);
+
+    if (verb == TELNET_WILL)
+    {
+        reply[1] = accepted ? TELNET_DO : TELNET_DONT;
+    }
+    else if (verb == TELNET_DO)
+    {
+        reply[1] = accepted ? TELNET_WILL : TELNET_WONT;
+    }
+    else
+    {
+        reply[1] = (verb == TELNET_WONT) ? TELNET_DONT : TELNET_WONT;
+    }
+
+    if (client->out_len + (int)sizeof(reply) > NET_BUF)
+    {
+        return;
+    }
+    memcpy(&client->out[client->out_len], reply, sizeof(reply));  // commands are never escaped
+    client->out_len += sizeof(reply);
+}
+
+// Function to strip telnet commands from client data, returns the bytes meant for the UART
+int net_from_client(struct net_client *client, unsigned char *buf, int len)
+{
+    int kept = 0;
+
+    if (!net.rfc2217)
+    {
+        return len;  // raw clients send plain data
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        switch (client->telnet_state)
+        {
+            case 0:
+                if (c == TELNET_IAC)
+                {
+                    client->telnet_state = 1;
+                }
+                else
+                {
+                    buf[kept++] = c;
+                }
+                break;
+            case 1:  // byte after IAC
+                if (c == TELNET_IAC)
+                {
+                    buf[kept++] = c;  // escaped 0xFF data byte
+                    client->telnet_state = 0;
+                }
+                else if (c >= TELNET_WILL)
+                {
+                    client->verb = c;
+                    client->telnet_state = 2;
+                }
+                else if (c == TELNET_SB)
+                {
+                    client->sb_len = 0;
+                    client->telnet_state = 3;
+                }
+                else
+                {
+                    client->telnet_state = 0;  // NOP, GA and friends carry nothing for the UART
+                }
+                break;
+            case 2:
+                net_option(client, client->verb, c);
+                client->telnet_state = 0;
+                break;
+            case 3:  // inside a subnegotiation
+                if (c == TELNET_IAC)
+                {
+                    client->telnet_state = 4;
+                }
+                else if (client->sb_len < (int)sizeof(client->sb))
+                {
+                    client->sb[client->sb_len++] = c;
+                }
+                break;
+            case 4:
+                if (c == TELNET_SE)
+                {
+                    if (client->sb_len >= 2 && client->sb[0] == TELNET_COMPORT)
+                    {
+                        rfc2217_command(client, &client->sb[1], client->sb_len - 1);
+                    }
+                    client->telnet_state = 0;
+                }
+                else
+                {
+                    if (client->sb_len < (int)sizeof(client->sb))
+                    {
+                        client->sb[client->sb_len++] = c;  // IAC IAC inside the subnegotiation
+                    }
+                    client->telnet_state = 3;
+                }
+                break;
+        }
+    }
+    return kept;
+}
+
+// Function to execute an RFC 2217 com port command and send the answer
+void rfc2217_command(struct net_client *client, const unsigned char *sb, int len)
+{
+    struct termios options;
+    unsigned char value[4] = { 0 };
+    int value_len = len - 1;
+    int modem;
+
+    // a payload shorter than the command needs is ignored: SET-BAUDRATE takes 4 bytes, the others 1
+    int needed = (sb[0] == 1) ? 4 : (((sb[0] >= 2 && sb[0] <= 5) || sb[0] == 12) ? 1 : 0);
+    if (value_len < needed)
+    {
+        return;
+    }
+    memcpy(value, &sb[1], value_len > 4 ? 4 : value_len);
+    tcgetattr(uart_fd, &options);
+
+    switch (sb[0])
+    {
+        case 1:  // SET-BAUDRATE, 4 bytes network order, 0 asks for the current rate
+        {
+            int baud = (value[0] << 24) | (value[1] << 16) | (value[2] << 8) | value[3];
+            if (baud && baud_to_speed(baud))
+            {
+                cfsetispeed(&options, baud_to_speed(baud));
+                cfsetospeed(&options, baud_to_speed(baud));
+                uart_baud = baud;
+            }
+            baud = speed_to_baud(cfgetospeed(&options));
+            value[0] = baud >> 24;
+            value[1] = baud >> 16;
+            value[2] = baud >> 8;
+            value[3] = baud;
+            value_len = 4;
+            break;
+        }
+        case 2:  // SET-DATASIZE
+            if (value[0] >= 5 && value[0] <= 8)
+            {
+                const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+                options.c_cflag = (options.c_cflag & ~CSIZE) | sizes[value[0] - 5];
+            }
+            switch (options.c_cflag & CSIZE)
+            {
+                case CS5: value[0] = 5; break;
+                case CS6: value[0] = 6; break;
+                case CS7: value[0] = 7; break;
+                default:  value[0] = 8; break;
+            }
+            break;
+        case 3:  // SET-PARITY: 1 none, 2 odd, 3 even
+            if (value[0] == 1)
+            {
+                options.c_cflag &= ~PARENB;
+            }
+            else if (value[0] == 2 || value[0] == 3)
+            {
+                options.c_cflag |= PARENB;
+                options.c_cflag = (value[0] == 2) ? (options.c_cflag | PARODD) : (options.c_cflag & ~PARODD);
+            }
+            value[0] = !(options.c_cflag & PARENB) ? 1 : ((options.c_cflag & PARODD) ? 2 : 3);
+            break;
+        case 4:  // SET-STOPSIZE: 1 or 2 stop bits
+            if (value[0] == 1 || value[0] == 2)
+            {
+                options.c_cflag = (value[0] == 2) ? (options.c_cflag | CSTOPB) : (options.c_cflag & ~CSTOPB);
+            }
+            value[0] = (options.c_cflag & CSTOPB) ? 2 : 1;
+            break;
+        case 5:  // SET-CONTROL: flow control and the DTR/RTS lines
+            ioctl(uart_fd, TIOCMGET, &modem);
+            if (value[0] == 1 || value[0] == 2 || value[0] == 3)
+            {
+                options.c_cflag &= ~CRTSCTS;
+                options.c_iflag &= ~(IXON | IXOFF);
+                if (value[0] == 2)
+                {
+                    options.c_iflag |= IXON | IXOFF;
+                }
+                else if (value[0] == 3)
+                {
+                    options.c_cflag |= CRTSCTS;
+                }
+            }
+            else if (value[0] == 8 || value[0] == 9)
+            {
+                modem = (value[0] == 8) ? (modem | TIOCM_DTR) : (modem & ~TIOCM_DTR);
+                ioctl(uart_fd, TIOCMSET, &modem);
+            }
+            else if (value[0] == 11 || value[0] == 12)
+            {
+                modem = (value[0] == 11) ? (modem | TIOCM_RTS) : (modem & ~TIOCM_RTS);
+                ioctl(uart_fd, TIOCMSET, &modem);
+            }
+            else if (value[0] == 0)  // query flow control
+            {
+                value[0] = (options.c_cflag & CRTSCTS) ? 3 : ((options.c_iflag & IXON) ? 2 : 1);
+            }
+            else if (value[0] == 7)  // query DTR
+            {
+                value[0] = (modem & TIOCM_DTR) ? 8 : 9;
+            }
+            else if (value[0] == 10)  // query RTS
+            {
+                value[0] = (modem & TIOCM_RTS) ? 11 : 12;
+            }
+            break;
+        case 12:  // PURGE-DATA: 1 receive, 2 transmit, 3 both
+            tcflush(uart_fd, value[0] == 1 ? TCIFLUSH : (value[0] == 2 ? TCOFLUSH : TCIOFLUSH));
+            break;
+        default:  // masks, suspend/resume: accepted as they are
+            break;
+    }
+    tcsetattr(uart_fd, TCSANOW, &options);
+
+    // answer: IAC SB COM-PORT-OPTION (command + 100) value IAC SE
+    unsigned char reply[4 + 2 * 4 + 2] = { TELNET_IAC, TELNET_SB, TELNET_COMPORT, sb[0] + 100 };
+    int reply_len = 4;
+    for (int i = 0; i < value_len && i < 4; i++)
+    {
+        if (value[i] == TELNET_IAC)
+        {
+            reply[reply_len++] = TELNET_IAC;
+        }
+        reply[reply_len++] = value[i];
+    }
+    reply[reply_len++] = TELNET_IAC;
+    reply[reply_len++] = TELNET_SE;
+    if (client->out_len + reply_len <= NET_BUF)
+    {
+        memcpy(&client->out[client->out_len], reply, reply_len);
+        client->out_len += reply_len;
+    }
+}
+
+// Function to run the socket event loop of the network bridge
+void* net_thread(void* arg)
+{
+    struct pollfd fds[NET_CLIENTS + 2];
+    unsigned char buf[4096];
+
+    while (1)
+    {
+        int queued = 0;
+        ioctl(uart_fd, TIOCOUTQ, &queued);
+        int uart_room = NET_TXQ_LIMIT - queued;  // client data stays in the socket while the UART is busy
+
+        pthread_mutex_lock(&net.lock);
+        fds[0].fd = net.listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = net.wake_fd;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < NET_CLIENTS; i++)
+        {
+            fds[i + 2].fd = net.clients[i].fd;
+            fds[i + 2].events = (uart_room > 0 ? POLLIN : 0) | (net.clients[i].out_len ? POLLOUT : 0);
+        }
+        pthread_mutex_unlock(&net.lock);
+
+        if (poll(fds, NET_CLIENTS + 2, uart_room > 0 ? -1 : 1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error polling sockets");
+            return NULL;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            unsigned long long count;
+            if (read(net.wake_fd, &count, sizeof(count)) < 0)
+            {
+                // nothing: the counter was drained by the previous round
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            struct sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            int fd = accept4(net.listen_fd, (struct sockaddr *)&peer, &peer_len, SOCK_NONBLOCK);
+            if (fd >= 0)
+            {
+                int one = 1, size = NET_SOCKBUF, slot = -1;
+                char addr[INET_ADDRSTRLEN];
+
+                // keystrokes and echoes must not wait for Nagle, bulk rides on the large buffers
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+                pthread_mutex_lock(&net.lock);
+                for (int i = 0; i < NET_CLIENTS && slot < 0; i++)
+                {
+                    if (net.clients[i].fd < 0)
+                    {
+                        slot = i;
+                    }
+                }
+                if (slot < 0)
+                {
+                    close(fd);  // all slots busy
+                }
+                else
+                {
+                    struct net_client *client = &net.clients[slot];
+                    memset(client, 0, sizeof(*client));
+                    client->fd = fd;
+                    if (net.rfc2217)
+                    {
+                        // offer binary transparent data and ask for com port control
+                        net_option(client, TELNET_DO, TELNET_BINARY);
+                        net_option(client, TELNET_DO, TELNET_SGA);
+                        net_option(client, TELNET_WILL, TELNET_BINARY);
+                        net_option(client, TELNET_WILL, TELNET_COMPORT);
+                    }
+                    inet_ntop(AF_INET, &peer.sin_addr, addr, sizeof(addr));
+                    printf("client %d connected from %s:%d\n", slot, addr, ntohs(peer.sin_port));
+                    fflush(stdout);
+                }
+                pthread_mutex_unlock(&net.lock);
+            }
+        }
+
+        for (int i = 0; i < NET_CLIENTS; i++)
+        {
+            struct net_client *client = &net.clients[i];
+            int closed = 0;
+
+            if (fds[i + 2].fd < 0)
+            {
+                continue;
+            }
+
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                int want = uart_room < (int)sizeof(buf) ? uart_room : (int)sizeof(buf);
+                int n = read(client->fd, buf, want > 0 ? want : 1);
+                if (n > 0)
+                {
+                    pthread_mutex_lock(&net.lock);
+                    n = net_from_client(client, buf, n);
+                    pthread_mutex_unlock(&net.lock);
+                    if (n > 0)
+                    {
+                        write_uart_len((const char *)buf, n);
+                        uart_room -= n;
+                    }
+                }
+                else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    closed = 1;
+                }
+            }
+
+            pthread_mutex_lock(&net.lock);
+            if (!closed && client->out_len)
+            {
+                // everything that piled up goes out in one send
+                int n = send(client->fd, client->out, client->out_len, MSG_NOSIGNAL);
+                if (n > 0)
+                {
+                    memmove(client->out, client->out + n, client->out_len - n);
+                    client->out_len -= n;
+                }
+                else if (n < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    closed = 1;
+                }
+            }
+            if (closed)
+            {
+                printf("client %d disconnected (%llu bytes dropped)\n", i, client->drops);
+                fflush(stdout);
+                close(client->fd);
+                client->fd = -1;
+                client->out_len = 0;
+            }
+            pthread_mutex_unlock(&net.lock);
+        }
+    }
+    return NULL;
+}
+
+// Function to allocate an empty slab for one UART read
+struct rx_slab* rx_slab_alloc(void)
+{
+    if (rx_cache == NULL)
+    {
+        pthread_mutex_lock(&rx_pool.lock);
+        if (rx_pool.free == NULL)
+        {
+            // grow the pool, this stops once enough slabs circulate between the threads
+            struct rx_slab *chunk = malloc(RX_POOL_CHUNK * sizeof(struct rx_slab));
+            if (chunk == NULL)
+            {
+                pthread_mutex_unlock(&rx_pool.lock);
+                return NULL;
+            }
+            for (int i = 0; i < RX_POOL_CHUNK; i++)
+            {
+                chunk[i].next = rx_pool.free;
+                rx_pool.free = &chunk[i];
+            }
+            rx_pool.free_count += RX_POOL_CHUNK;
+            rx_pool.chunks++;
+        }
+        while (rx_pool.free && rx_cache_count < RX_POOL_BATCH)
+        {
+            struct rx_slab *slab = rx_pool.free;
+            rx_pool.free = slab->next;
+            rx_pool.free_count--;
+            slab->next = rx_cache;
+            rx_cache = slab;
+            rx_cache_count++;
+        }
+        rx_pool.refills++;
+        pthread_mutex_unlock(&rx_pool.lock);
+    }
+
+    struct rx_slab *slab = rx_cache;
+    rx_cache = slab->next;
+    rx_cache_count--;
+    slab->refs = 1;  // the ring reference
+    slab->len = 0;
+    slab->event = 0;
+    return slab;
+}
+
+// Function to drop one reference of a slab, recycling it with the last one
+void rx_slab_release(struct rx_slab *slab)
+{
+    if (__atomic_sub_fetch(&slab->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        slab->next = rx_cache;
+        rx_cache = slab;
+        if (++rx_cache_count >= 2 * RX_POOL_BATCH)
+        {
+            rx_cache_flush(RX_POOL_BATCH);  // keep one batch for this thread
+        }
+    }
+}
+
+// Function to give (count) slabs of the thread cache back to the shared pool
+void rx_cache_flush(int count)
+{
+    pthread_mutex_lock(&rx_pool.lock);
+    while (rx_cache && count--)
+    {
+        struct rx_slab *slab = rx_cache;
+        rx_cache = slab->next;
+        rx_cache_count--;
+        slab->next = rx_pool.free;
+        rx_pool.free = slab;
+        rx_pool.free_count++;
+    }
+    rx_pool.returns++;
+    pthread_mutex_unlock(&rx_pool.lock);
+}
+
+// Function to publish a filled slab to all subscribers
+void rx_publish(struct rx_slab *slab)
+{
+    pthread_mutex_lock(&rx.lock);
+
+    // backpressure: never overwrite a slab a blocking subscriber has not read yet.
+    // The lock is released while waiting, so the other publisher (reader or modem monitor) may have
+    // filled the ring again meanwhile: start over until one pass over all subscribers did not wait
+    int waited = 1;
+    while (waited)
+    {
+        waited = 0;
+        for (int i = 0; i < RX_SUBSCRIBERS; i++)
+        {
+            struct rx_subscriber *sub = &rx.subs[i];
+            while (sub->used && !sub->stop && sub->policy == RX_POLICY_BLOCK
+                   && rx.head - sub->cursor >= RX_RING_SLOTS)
+            {
+                pthread_cond_wait(&rx.room, &rx.lock);
+                waited = 1;
+            }
+        }
+    }
+
+    struct rx_slab *old = rx.slots[rx.head % RX_RING_SLOTS];
+    rx.slots[rx.head % RX_RING_SLOTS] = slab;
+    rx.head++;
+    pthread_cond_broadcast(&rx.more);
+    pthread_mutex_unlock(&rx.lock);
+
+    if (old)
+    {
+        rx_slab_release(old);  // subscribers still processing it keep it alive
+    }
+}
+
+// Function to add a consumer of the received data, it starts with the next published slab
+struct rx_subscriber* rx_subscribe(const char *name, int policy, int fd,
+                                   void (*deliver)(struct rx_subscriber *sub, const char *data, int len))
+{
+    return rx_subscribe_from(name, policy, fd, deliver, RX_FROM_HEAD);
+}
+
+// Function to add a consumer of the received data starting at slab sequence (from)
+struct rx_subscriber* rx_subscribe_from(const char *name, int policy, int fd,
+                                        void (*deliver)(struct rx_subscriber *sub, const char *data, int len),
+                                        unsigned long long from)
+{
+    struct rx_subscriber *sub = NULL;
+
+    pthread_mutex_lock(&rx.lock);
+    for (int i = 0; i < RX_SUBSCRIBERS && sub == NULL; i++)
+    {
+        if (!rx.subs[i].used)
+        {
+            sub = &rx.subs[i];
+        }
+    }
+    if (sub)
+    {
+        memset(sub, 0, sizeof(*sub));
+        sub->used = 1;
+        sub->policy = policy;
+        sub->fd = fd;
+        sub->deliver = deliver;
+        sub->cursor = (from == RX_FROM_HEAD || from > rx.head) ? rx.head : from;
+        snprintf(sub->name, sizeof(sub->name), "%s", name);
+        if (pthread_create(&sub->tid, NULL, rx_subscriber_thread, sub) != 0)
+        {
+            perror("Error creating subscriber thread");
+            sub->used = 0;
+            sub = NULL;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "too many receive subscribers\n");
+    }
+    pthread_mutex_unlock(&rx.lock);
+    return sub;
+}
+
+// Function to stop the subscriber with that name
+StdReturn rx_unsubscribe(const char *name)
+{
+    pthread_mutex_lock(&rx.lock);
+    for (int i = 0; i < RX_SUBSCRIBERS; i++)
+    {
+        struct rx_subscriber *sub = &rx.subs[i];
+        if (sub->used && !sub->stop && strcmp(sub->name, name) == 0)
+        {
+            sub->stop = 1;  // the thread frees the slot when it leaves
+            pthread_cond_broadcast(&rx.more);
+            pthread_cond_broadcast(&rx.room);
+            pthread_mutex_unlock(&rx.lock);
+            return E_OK;
+        }
+    }
+    pthread_mutex_unlock(&rx.lock);
+    return E_NOK;
+}
+
+// Function to feed one subscriber with the slabs published after its cursor
+void* rx_subscriber_thread(void* arg)
+{
+    struct rx_subscriber *sub = arg;
+
+    pthread_detach(pthread_self());
+    pthread_mutex_lock(&rx.lock);
+    while (!sub->stop)
+    {
+        if (sub->cursor == rx.head)
+        {
+            if (sub->idle && sub->idle_armed && sub->idle_ms > 0)
+            {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += sub->idle_ms / 1000;
+                deadline.tv_nsec += (sub->idle_ms % 1000) * 1000000L;
+                if (deadline.tv_nsec >= 1000000000)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                if (pthread_cond_timedwait(&rx.more, &rx.lock, &deadline) != 0
+                    && sub->cursor == rx.head && sub->idle_armed)  // the shutdown may have flushed it
+                {
+                    sub->idle_armed = 0;
+                    sub->busy = 1;
+                    pthread_mutex_unlock(&rx.lock);
+                    sub->idle(sub);
+                    pthread_mutex_lock(&rx.lock);
+                    sub->busy = 0;
+                }
+            }
+            else
+            {
+                pthread_cond_wait(&rx.more, &rx.lock);
+            }
+            continue;
+        }
+        if (rx.head - sub->cursor > RX_RING_SLOTS)
+        {
+            // only possible with the drop policy: the slabs we missed are overwritten
+            sub->drops += rx.head - RX_RING_SLOTS - sub->cursor;
+            sub->cursor = rx.head - RX_RING_SLOTS;
+        }
+
+        struct rx_slab *slab = rx.slots[sub->cursor % RX_RING_SLOTS];
+        int len = (slab->event && sub->deliver != rx_capture) ? 0 : slab->len;  // modem events only go to captures
+        sub->slab_us = slab->rx_us;
+        sub->idle_armed = 1;
+        __atomic_add_fetch(&slab->refs, 1, __ATOMIC_ACQ_REL);
+        sub->cursor++;
+        sub->busy = 1;
+        pthread_cond_broadcast(&rx.room);
+        pthread_mutex_unlock(&rx.lock);
+
+        if (len)
+        {
+            sub->deliver(sub, slab->data, len);  // outside the lock, the reader keeps going
+        }
+        rx_slab_release(slab);
+
+        pthread_mutex_lock(&rx.lock);
+        sub->busy = 0;
+        sub->bytes += len;
+    }
+    if (sub->fd >= 0)
+    {
+        close(sub->fd);
+    }
+    sub->used = 0;
+    pthread_cond_broadcast(&rx.room);
+    pthread_mutex_unlock(&rx.lock);
+    rx_cache_flush(rx_cache_count);  // the cache dies with the thread
+    return NULL;
+}
+
+// Function to show or save received data as selected by R> / R>> (the shell view)
+void rx_primary(struct rx_subscriber *sub, const char *data, int len)
+{
+    char buf[RX_SLAB_SIZE + 1];
+    struct rx_sink *sink = rx_sink_enter();
+
+    if(sink->kind == OUT_FLAG_SHELL && ctl_awaiting_offer)
+    {
+        // strip the control frames of a resume negotiation before showing the data
+        int kept = 0;
+        for (int i = 0; i < len; i++)
+        {
+            if (ctl_feed(sink, data[i]))
+            {
+                buf[kept++] = data[i];
+            }
+        }
+        buf[kept] = '\0';
+        data = buf;  // the slab is shared, filter into our own copy
+        len = kept;
+    }
+
+    if (len == 0)
+    {
+        // nothing left to show
+    }
+    else if(sink->kind == OUT_FLAG_RESUME)
+    {
+        resume_receive(sink, data, len);  // negotiation frames and file data of R>>
+    }
+    else if(sink->kind == OUT_FLAG_SHELL && __atomic_load_n(&charmode.active, __ATOMIC_RELAXED))
+    {
+        if (rx_line.len)
+        {
+            write(STDOUT_FILENO, rx_line.text, rx_line.len);  // the partial line shown before
+            rx_line.len = 0;
+        }
+        write(STDOUT_FILENO, data, len);  // escape sequences of the target reach the terminal
+    }
+    else if(sink->kind == OUT_FLAG_SHELL)
+    {
+        line_feed(data, len, sub->slab_us);  // one "Received" line per received line
+    }
+    else if(sink->kind == OUT_FLAG_DEST)
+    {
+        // write to destination
+        int bytes_written = write(sink->fd, data, len);
+        if (bytes_written != len) 
+        {
+            perror("Error writing to destination file\n");
+        }
+        else if (!__atomic_load_n(&charmode.active, __ATOMIC_RELAXED))
+        {
+            // Delete previous input text and prepare the terminal for new received data
+            clear_prompt();
+
+            // Print received data to the terminal
+            printf("\033[0;32mReceived:\033[0m saved %d to file.\n",bytes_written);
+            fflush(stdout);  // Flush the output buffer to print immediately
+
+            // Ask the user to enter text to send after displaying the received data
+            redraw_prompt();
+        }
+    }
+    rx_sink_leave();
+}
+
+// Function to show the partial line of the shell view after the idle timeout
+void rx_primary_idle(struct rx_subscriber *sub)
+{
+    struct rx_sink *sink = rx_sink_enter();
+    if (sink->kind == OUT_FLAG_SHELL && rx_line.len && !__atomic_load_n(&charmode.active, __ATOMIC_RELAXED))
+    {
+        line_emit();
+        redraw_prompt();  // line_emit removed it
+        rx_line.prompt_cleared = 0;
+    }
+    rx_sink_leave();
+}
+
+// Function to add received bytes to the line being assembled, printing completed lines
+void line_feed(const char *data, int len, long long rx_us)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (rx_line.len == 0)
+        {
+            rx_line.first_us = rx_us;  // the line is dated by its first byte
+        }
+        if (data[i] == '\n')
+        {
+            line_emit();
+            continue;
+        }
+        rx_line.text[rx_line.len++] = data[i];
+        if (rx_line.len == LINE_MAX_LEN)
+        {
+            line_emit();  // overlong line: shown in pieces
+        }
+    }
+
+    if (rx_line.prompt_cleared)
+    {
+        // Ask the user to enter text to send after displaying the received data
+        redraw_prompt();
+        rx_line.prompt_cleared = 0;
+    }
+}
+
+// Function to print the assembled line with its timestamps
+void line_emit(void)
+{
+    char stamp[40];
+
+    if (rx_line.len && rx_line.text[rx_line.len - 1] == '\r')
+    {
+        rx_line.len--;  // CR LF line ends
+    }
+    rx_line.text[rx_line.len] = '\0';
+
+    if (!rx_line.prompt_cleared)
+    {
+        // Delete previous input text once for all the lines of this read
+        clear_prompt();
+        rx_line.prompt_cleared = 1;
+    }
+
+    format_stamp(rx_line.first_us, stamp, sizeof(stamp));
+    printf("\033[0;32mReceived [%s]:\033[0m %s\n", stamp, rx_line.text);
+    rx_line.len = 0;
+}
+
+// Function to format a monotonic time as wall clock time and seconds since start
+void format_stamp(long long us, char *out, int size)
+{
+    long long since_start = us - start_us;
+    long long wall_ms = (long long)start_wall.tv_sec * 1000 + start_wall.tv_nsec / 1000000 + since_start / 1000;
+    time_t wall_sec = wall_ms / 1000;
+    struct tm tm;
+
+    localtime_r(&wall_sec, &tm);
+    snprintf(out, size, "%02d:%02d:%02d.%03lld +%lld.%06lld", tm.tm_hour, tm.tm_min, tm.tm_sec,
+             wall_ms % 1000, since_start / 1000000, since_start % 1000000);
+}
+
+// Function to store one line in the scrollback
+void scroll_add(char dir, const char *text, int len, long long us)
+{
+    if ((unsigned long long)len >= scroll.size)
+    {
+        len = scroll.size - 1;  // a line longer than the whole scrollback keeps its start
+    }
+    pthread_mutex_lock(&scroll.lock);
+    if (scroll.data == NULL)
+    {
+        // reserved only: pages are backed by memory when the text reaches them
+        scroll.slots = scroll.size / SCROLL_AVG_LINE;
+        scroll.data = mmap(NULL, scroll.size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        scroll.lines = mmap(NULL, scroll.slots * sizeof(struct scroll_line), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (scroll.data == MAP_FAILED || scroll.lines == MAP_FAILED)
+        {
+            perror("Error allocating scrollback");
+            scroll.size = 0;
+            pthread_mutex_unlock(&scroll.lock);
+            return;
+        }
+    }
+
+    unsigned long long pos = scroll.head % scroll.size;
+    if (pos + len + 1 > scroll.size)
+    {
+        memset(scroll.data + pos, '\n', scroll.size - pos);  // the gap matches no search
+        scroll.head += scroll.size - pos;
+        pos = 0;
+    }
+    memcpy(scroll.data + pos, text, len);
+    scroll.data[pos + len] = '\n';
+    scroll.head += len + 1;
+
+    // forget the lines the new text overwrote, and the oldest one when the index is full
+    while (scroll.first < scroll.count
+           && (scroll.count - scroll.first == scroll.slots
+               || scroll.lines[scroll.first % scroll.slots].off + scroll.size < scroll.head))
+    {
+        scroll.first++;
+    }
+    struct scroll_line *line = &scroll.lines[scroll.count % scroll.slots];
+    line->off = scroll.head - len - 1;
+    line->us = us;
+    line->len = len;
+    line->dir = dir;
+    scroll.count++;
+    pthread_mutex_unlock(&scroll.lock);
+}
+
+// Function to split received data into scrollback lines
+void rx_scroll(struct rx_subscriber *sub, const char *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (scroll.line_len == 0)
+        {
+            scroll.line_us = sub->slab_us;
+        }
+        if (data[i] == '\n' || scroll.line_len == LINE_MAX_LEN)
+        {
+            int text_len = scroll.line_len;
+            if (text_len && scroll.line[text_len - 1] == '\r')
+            {
+                text_len--;
+            }
+            scroll_add(SCROLL_RX, scroll.line, text_len, scroll.line_us);
+            scroll.line_len = 0;
+            if (data[i] == '\n')
+            {
+                continue;
+            }
+            scroll.line_us = sub->slab_us;
+        }
+        scroll.line[scroll.line_len++] = data[i];
+    }
+}
+
+// Function to store the partial received line after the idle timeout
+void rx_scroll_idle(struct rx_subscriber *sub)
+{
+    if (scroll.line_len)
+    {
+        scroll_add(SCROLL_RX, scroll.line, scroll.line_len, scroll.line_us);
+        scroll.line_len = 0;
+    }
+}
+
+// Function to find the scrollback line holding the byte at logical offset (off)
+unsigned long long scroll_find(unsigned long long off)
+{
+    unsigned long long lo = scroll.first, hi = scroll.count - 1;
+    while (lo < hi)  // last line starting at or before off
+    {
+        unsigned long long mid = lo + (hi - lo + 1) / 2;
+        if (scroll.lines[mid % scroll.slots].off <= off)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Function to print one scrollback line (scroll.lock held)
+void scroll_print(FILE *out, unsigned long long seq, int hit)
+{
+    struct scroll_line *line = &scroll.lines[seq % scroll.slots];
+    char stamp[40];
+
+    format_stamp(line->us, stamp, sizeof(stamp));
+    fprintf(out, "%s[%s] %s\033[0m %.*s\n", hit ? "\033[1;33m" : "\033[0;90m", stamp,
+           line->dir == SCROLL_RX ? "RX" : "TX", line->len, scroll.data + line->off % scroll.size);
+}
+
+// Function to search the scrollback, all matching lines (grep) or the latest one with context (search)
+void scroll_search(const char *pattern, int all)
+{
+    int pattern_len = strlen(pattern);
+    unsigned long long matches = 0, last = 0;
+    char *text = NULL, *seam = malloc(2 * pattern_len + 1);
+    size_t size = 0;
+
+    pthread_mutex_lock(&scroll.lock);
+    if (pattern_len == 0 || scroll.first == scroll.count || seam == NULL)
+    {
+        pthread_mutex_unlock(&scroll.lock);
+        printf("scrollback: nothing to search\n");
+        free(seam);
+        return;
+    }
+    // the result is formatted in memory and printed once the lock is released:
+    // a slow terminal must not hold up rx_scroll, and through it the reader
+    FILE *out = open_memstream(&text, &size);
+    if (out == NULL)
+    {
+        pthread_mutex_unlock(&scroll.lock);
+        perror("Error searching the scrollback");
+        free(seam);
+        return;
+    }
+
+    // memmem over the stored text as it lies in memory: at most two contiguous chunks
+    unsigned long long pos = scroll.lines[scroll.first % scroll.slots].off;
+    while (pos < scroll.head)
+    {
+        unsigned long long phys = pos % scroll.size;
+        unsigned long long chunk = scroll.head - pos;
+        if (phys + chunk > scroll.size)
+        {
+            chunk = scroll.size - phys;
+        }
+        unsigned long long at = 0;
+        char *hit = memmem(scroll.data + phys, chunk, pattern, pattern_len);
+        if (hit)
+        {
+            at = pos + (hit - (scroll.data + phys));
+        }
+        else if (phys + chunk == scroll.size && pos + chunk < scroll.head && pattern_len > 1)
+        {
+            // a match across the end of the ring: the last bytes before it joined with the first after it
+            int before = chunk < (unsigned long long)pattern_len - 1 ? (int)chunk : pattern_len - 1;
+            int after = scroll.head - (pos + chunk) < (unsigned long long)pattern_len - 1
+                        ? (int)(scroll.head - (pos + chunk)) : pattern_len - 1;
+            memcpy(seam, scroll.data + scroll.size - before, before);
+            memcpy(seam + before, scroll.data, after);
+            hit = memmem(seam, before + after, pattern, pattern_len);
+            at = hit ? pos + chunk - before + (hit - seam) : 0;
+        }
+        if (hit == NULL)
+        {
+            pos += chunk;
+            continue;
+        }
+        unsigned long long seq = scroll_find(at);
+        matches++;
+        last = seq;
+        if (all)
+        {
+            scroll_print(out, seq, 1);
+        }
+        pos = scroll.lines[seq % scroll.slots].off + scroll.lines[seq % scroll.slots].len + 1;  // next line
+    }
+
+    if (!all && matches)
+    {
+        unsigned long long from = last >= scroll.first + SCROLL_CONTEXT ? last - SCROLL_CONTEXT : scroll.first;
+        for (unsigned long long seq = from; seq < scroll.count && seq <= last + SCROLL_CONTEXT; seq++)
+        {
+            scroll_print(out, seq, seq == last);
+        }
+    }
+    fprintf(out, "scrollback: %llu matching lines of %llu\n", matches, scroll.count - scroll.first);
+    pthread_mutex_unlock(&scroll.lock);
+
+    fclose(out);
+    fwrite(text, 1, size, stdout);
+    free(text);
+    free(seam);
+}
+
+// Function to append received data to an additional capture file (R+file)
+void rx_capture(struct rx_subscriber *sub, const char *data, int len)
+{
+    struct stat st;
+    if (capture_max && sub->file_bytes == 0 && sub->fd >= 0 && fstat(sub->fd, &st) == 0)
+    {
+        sub->file_bytes = st.st_size;  // appending to an existing file
+    }
+    if (capture_max && sub->file_bytes && sub->file_bytes + len > capture_max)
+    {
+        capture_rotate(sub);
+    }
+    if (sub->fd >= 0 && write(sub->fd, data, len) != len)
+    {
+        perror("Error writing to capture file\n");
+    }
+    sub->file_bytes += len;
+}
+
+// Function to start a new capture file once the current one reached --capture-max
+void capture_rotate(struct rx_subscriber *sub)
+{
+    char from[BUF_SIZE + 16], to[BUF_SIZE + 16];
+
+    fdatasync(sub->fd);
+    close(sub->fd);
+    // boot.log.4 -> boot.log.5 ... boot.log -> boot.log.1, the oldest one is replaced
+    for (int i = capture_keep - 1; i >= 0; i--)
+    {
+        if (i == 0)
+        {
+            snprintf(from, sizeof(from), "%s", sub->name);
+        }
+        else
+        {
+            snprintf(from, sizeof(from), "%s.%d", sub->name, i);
+        }
+        snprintf(to, sizeof(to), "%s.%d", sub->name, i + 1);
+        rename(from, to);  // generations that do not exist yet are simply missing
+    }
+    sub->fd = open(sub->name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (sub->fd < 0)
+    {
+        perror("Error rotating capture file");
+    }
+    sub->file_bytes = 0;
+}
+
+// Function to deliver received data to the multiplexer channels
+void rx_mux(struct rx_subscriber *sub, const char *data, int len)
+{
+    mux_demux(data, len);  // every byte belongs to a channel frame
+}
+
+// Function to deliver received data to the TCP clients
+void rx_net(struct rx_subscriber *sub, const char *data, int len)
+{
+    net_broadcast(data, len);  // the TCP clients own the received data
+}
+
+// Function to write received data unmodified to stdout (--pipe)
+void rx_pipe(struct rx_subscriber *sub, const char *data, int len)
+{
+    __atomic_store_n(&pipe_last_rx, monotonic_ms(), __ATOMIC_RELAXED);
+    while (len > 0)  // a pipe may take less than asked, the blocking policy slows the UART down
+    {
+        int n = write(STDOUT_FILENO, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EPIPE)
+            {
+                exit(E_OK);  // the reader of the pipeline is gone
+            }
+            perror("Error writing to stdout");
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Function to move stdin to the UART, with splice when the kernel allows it (--pipe)
+void* pipe_thread(void* arg)
+{
+    static char chunk[PIPE_CHUNK];
+    int use_splice = 1;
+
+    while (1)
+    {
+        unsigned long long generation = __atomic_load_n(&hotplug.generation, __ATOMIC_RELAXED);
+        int n;
+        if (__atomic_load_n(&hotplug.lost, __ATOMIC_RELAXED))
+        {
+            port_wait();  // stdin stays unread instead of going to /dev/null
+        }
+        if (use_splice)
+        {
+            // zero copy from a stdin pipe, needs a pipe on one side and a tty that accepts splice
+            n = splice(STDIN_FILENO, NULL, uart_fd, NULL, PIPE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && (errno == EINVAL || errno == ESPIPE || errno == EBADF))
+            {
+                use_splice = 0;  // stdin is a file/terminal or the tty has no splice support
+                continue;
+            }
+        }
+        else
+        {
+            n = read(STDIN_FILENO, chunk, PIPE_CHUNK);
+            if (n > 0 && write_uart_len(chunk, n) != n)
+            {
+                perror("Error writing to UART");
+                return NULL;
+            }
+        }
+
+        if (n == 0)
+        {
+            return NULL;  // EOF
+        }
+        if (n < 0 && (errno == EIO || errno == ENXIO || errno == ENODEV))
+        {
+            port_lost(generation);  // unplugged while splicing, the data is still in the pipe
+            continue;
+        }
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+        {
+            perror("Error reading stdin");
+            return NULL;
+        }
+    }
+}
+
+// Function to compile a set of patterns into an Aho-Corasick automaton
+StdReturn ac_compile(struct ac_automaton *ac, char **patterns, const int *lengths, int count)
+{
+    int max_states = 1;
+    for (int i = 0; i < count; i++)
+    {
+        max_states += lengths[i];
+    }
+
+    int *fail = malloc(max_states * sizeof(int));
+    int *queue = malloc(max_states * sizeof(int));
+    ac->next = malloc((size_t)max_states * 256 * sizeof(int));
+    ac->match = malloc(max_states * sizeof(int));
+    ac->own = malloc(max_states * sizeof(int));
+    ac->dict = malloc(max_states * sizeof(int));
+    ac->same = malloc((count ? count : 1) * sizeof(int));
+    if (!fail || !queue || !ac->next || !ac->match || !ac->own || !ac->dict || !ac->same)
+    {
+        free(fail);
+        free(queue);
+        return E_NOK;
+    }
+    memset(ac->next, -1, (size_t)max_states * 256 * sizeof(int));
+    memset(ac->match, -1, max_states * sizeof(int));
+    memset(ac->own, -1, max_states * sizeof(int));
+    memset(ac->dict, -1, max_states * sizeof(int));
+    memset(ac->same, -1, (count ? count : 1) * sizeof(int));
+    ac->states = 1;
+
+    // trie of all patterns
+    for (int i = 0; i < count; i++)
+    {
+        int state = 0;
+        for (int j = 0; j < lengths[i]; j++)
+        {
+            unsigned char c = patterns[i][j];
+            if (ac->next[state * 256 + c] < 0)
+            {
+                ac->next[state * 256 + c] = ac->states++;
+            }
+            state = ac->next[state * 256 + c];
+        }
+        if (ac->match[state] < 0)
+        {
+            ac->match[state] = i;
+            ac->own[state] = i;
+        }
+        else
+        {
+            // the same pattern again: match keeps the first one, the others are chained behind it
+            int last = ac->own[state];
+            while (ac->same[last] >= 0)
+            {
+                last = ac->same[last];
+            }
+            ac->same[last] = i;
+        }
+    }
+
+    // breadth first: failure links, inherited matches and the missing transitions,
+    // so matching never has to follow a failure link at run time
+    int head = 0, tail = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        int child = ac->next[c];
+        if (child < 0)
+        {
+            ac->next[c] = 0;
+        }
+        else
+        {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail)
+    {
+        int state = queue[head++];
+        if (ac->match[state] < 0)
+        {
+            ac->match[state] = ac->match[fail[state]];  // a shorter pattern ends here too
+        }
+        ac->dict[state] = (ac->own[fail[state]] >= 0) ? fail[state] : ac->dict[fail[state]];
+        for (int c = 0; c < 256; c++)
+        {
+            int child = ac->next[state * 256 + c];
+            if (child < 0)
+            {
+                ac->next[state * 256 + c] = ac->next[fail[state] * 256 + c];
+            }
+            else
+            {
+                fail[child] = ac->next[fail[state] * 256 + c];
+                queue[tail++] = child;
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return E_OK;
+}
+
+// Function to read one word or quoted string (with \r \n \t \xHH escapes) from a script line
+int script_token(char **cursor, char *out, int size, int *quoted)
+{
+    char *p = *cursor;
+    int len = 0;
+
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+    if (*p == '\0' || *p == '#' || *p == '\n' || *p == '\r')
+    {
+        return -1;  // end of line
+    }
+
+    *quoted = (*p == '"');
+    if (*quoted)
+    {
+        p++;
+        while (*p && *p != '"' && len < size - 1)
+        {
+            char c = *p++;
+            if (c == '\\' && *p)
+            {
+                c = *p++;
+                if (c == 'r') c = '\r';
+                else if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+                else if (c == 'x' && p[0] && p[1])
+                {
+                    char hex[3] = { p[0], p[1], 0 };
+                    c = (char)strtol(hex, NULL, 16);
+                    p += 2;
+                }
+            }
+            out[len++] = c;
+        }
+        if (*p == '"')
+        {
+            p++;
+        }
+    }
+    else
+    {
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' && len < size - 1)
+        {
+            out[len++] = *p++;
+        }
+    }
+    out[len] = '\0';
+    *cursor = p;
+    return len;
+}
+
+// Function to load and compile an automation script
+StdReturn script_load(const char *file)
+{
+    char line[1024], word[BUF_SIZE];
+    int line_no = 0, quoted;
+
+    FILE *in = fopen(file, "r");
+    if (in == NULL)
+    {
+        perror("Error opening script");
+        return E_NOK;
+    }
+
+    while (fgets(line, sizeof(line), in))
+    {
+        char *cursor = line;
+        line_no++;
+        if (script_token(&cursor, word, sizeof(word), &quoted) < 0)
+        {
+            continue;  // empty line or comment
+        }
+
+        if (!quoted && word[strlen(word) - 1] == ':')  // label:
+        {
+            if (script.label_count == SCRIPT_STEPS)
+            {
+                fprintf(stderr, "%s:%d: too many labels\n", file, line_no);
+                fclose(in);
+                return E_NOK;
+            }
+            word[strlen(word) - 1] = '\0';
+            snprintf(script.labels[script.label_count], 32, "%.31s", word);
+            script.label_step[script.label_count++] = script.count;
+            continue;
+        }
+        if (script.count == SCRIPT_STEPS)
+        {
+            fprintf(stderr, "%s:%d: too many statements\n", file, line_no);
+            fclose(in);
+            return E_NOK;
+        }
+
+        struct script_step *step = &script.steps[script.count];
+        memset(step, 0, sizeof(*step));
+        step->line = line_no;
+        step->timeout_target = -1;
+
+        if (strcmp(word, "send") == 0)
+        {
+            step->op = SCRIPT_OP_SEND;
+            step->text_len = script_token(&cursor, step->text, sizeof(step->text), &quoted);
+        }
+        else if (strcmp(word, "expect") == 0)
+        {
+            int lengths[SCRIPT_PATTERNS];
+            int len;
+            step->op = SCRIPT_OP_EXPECT;
+            while ((len = script_token(&cursor, word, sizeof(word), &quoted)) >= 0)
+            {
+                if (quoted && len > 0 && step->patterns == SCRIPT_PATTERNS)
+                {
+                    // dropping it would give its label to the pattern before it
+                    fprintf(stderr, "%s:%d: too many patterns (max %d)\n", file, line_no, SCRIPT_PATTERNS);
+                    fclose(in);
+                    return E_NOK;
+                }
+                else if (quoted && len > 0)
+                {
+                    step->pattern[step->patterns] = malloc(len + 1);
+                    memcpy(step->pattern[step->patterns], word, len + 1);
+                    lengths[step->patterns++] = len;
+                }
+                else if (!quoted && strcmp(word, "timeout") == 0
+                         && script_token(&cursor, word, sizeof(word), &quoted) > 0)
+                {
+                    snprintf(step->label[SCRIPT_PATTERNS], 32, "%.31s", word);
+                }
+                else if (!quoted && step->patterns > 0)
+                {
+                    snprintf(step->label[step->patterns - 1], 32, "%.31s", word);  // target of the last pattern
+                }
+            }
+            if (step->patterns == 0 || ac_compile(&step->ac, step->pattern, lengths, step->patterns) != E_OK)
+            {
+                fprintf(stderr, "%s:%d: expect needs at least one \"pattern\"\n", file, line_no);
+                fclose(in);
+                return E_NOK;
+            }
+        }
+        else if (strcmp(word, "timeout") == 0 || strcmp(word, "sleep") == 0 || strcmp(word, "exit") == 0)
+        {
+            step->op = (word[0] == 't') ? SCRIPT_OP_TIMEOUT : ((word[0] == 's') ? SCRIPT_OP_SLEEP : SCRIPT_OP_EXIT);
+            step->value = (script_token(&cursor, word, sizeof(word), &quoted) > 0) ? atoi(word) : 0;
+        }
+        else if (strcmp(word, "goto") == 0 && script_token(&cursor, word, sizeof(word), &quoted) > 0)
+        {
+            step->op = SCRIPT_OP_GOTO;
+            snprintf(step->label[0], 32, "%.31s", word);
+        }
+        else if (strcmp(word, "rpc") == 0 && script_token(&cursor, step->text, sizeof(step->text), &quoted) > 0)
+        {
+            step->op = SCRIPT_OP_RPC;
+            rpc.wanted = 1;
+        }
+        else if (strcmp(word, "rpc-wait") == 0)
+        {
+            step->op = SCRIPT_OP_RPC_WAIT;
+            if (script_token(&cursor, word, sizeof(word), &quoted) > 0)
+            {
+                snprintf(step->label[0], 32, "%.31s", word);  // where to continue when a request failed
+            }
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown statement %s\n", file, line_no, word);
+            fclose(in);
+            return E_NOK;
+        }
+        script.count++;
+    }
+    fclose(in);
+
+    // resolve the labels now that all of them are known
+    for (int i = 0; i < script.count; i++)
+    {
+        struct script_step *step = &script.steps[i];
+        for (int j = 0; j <= SCRIPT_PATTERNS; j++)
+        {
+            int target = -1;
+            if (step->label[j][0])
+            {
+                for (int k = 0; k < script.label_count && target < 0; k++)
+                {
+                    if (strcmp(script.labels[k], step->label[j]) == 0)
+                    {
+                        target = script.label_step[k];
+                    }
+                }
+                if (target < 0)
+                {
+                    fprintf(stderr, "%s:%d: unknown label %s\n", file, step->line, step->label[j]);
+                    return E_NOK;
+                }
+            }
+            if (step->op == SCRIPT_OP_GOTO && j == 0)
+            {
+                step->value = target;
+            }
+            else if (j == SCRIPT_PATTERNS)
+            {
+                step->timeout_target = target;
+            }
+            else
+            {
+                step->target[j] = target;
+            }
+        }
+    }
+    return E_OK;
+}
+
+// Function to wait until one pattern of an expect matches, returns its index or -1 on timeout
+int script_expect(struct script_step *step, int timeout_ms)
+{
+    struct timespec deadline;
+    int state = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&script.lock);
+    while (1)
+    {
+        // every received byte is scanned once, whatever the number of patterns
+        while (script.rx_tail < script.rx_head)
+        {
+            unsigned char c = script.rx[script.rx_tail++ % SCRIPT_RX_BUF];
+            state = step->ac.next[state * 256 + c];
+            if (step->ac.match[state] >= 0)
+            {
+                pthread_mutex_unlock(&script.lock);
+                return step->ac.match[state];  // the next expect starts after this byte
+            }
+        }
+        if (pthread_cond_timedwait(&script.more, &script.lock, &deadline) != 0)
+        {
+            pthread_mutex_unlock(&script.lock);
+            return -1;
+        }
+    }
+}
+
+// Function to run the loaded script, returns the exit code
+int script_run(void)
+{
+    int timeout_ms = 10000;  // default expect timeout
+    int pc = 0;
+
+    while (pc >= 0 && pc < script.count)
+    {
+        struct script_step *step = &script.steps[pc];
+        pc++;
+        switch (step->op)
+        {
+            case SCRIPT_OP_SEND:
+                write_uart_len(step->text, step->text_len);
+                break;
+            case SCRIPT_OP_EXPECT:
+            {
+                int hit = script_expect(step, timeout_ms);
+                if (hit < 0)
+                {
+                    fprintf(stderr, "[script] line %d: timeout after %d ms\n", step->line, timeout_ms);
+                    if (step->timeout_target < 0)
+                    {
+                        return 2;  // unhandled timeout fails the script
+                    }
+                    pc = step->timeout_target;
+                }
+                else
+                {
+                    fprintf(stderr, "[script] line %d: matched \"%s\"\n", step->line, step->pattern[hit]);
+                    if (step->target[hit] >= 0)
+                    {
+                        pc = step->target[hit];
+                    }
+                }
+                break;
+            }
+            case SCRIPT_OP_TIMEOUT:
+                timeout_ms = step->value;
+                break;
+            case SCRIPT_OP_GOTO:
+                pc = step->value;
+                break;
+            case SCRIPT_OP_SLEEP:
+                usleep(step->value * 1000);
+                break;
+            case SCRIPT_OP_EXIT:
+                tcdrain(uart_fd);
+                return step->value;
+            case SCRIPT_OP_RPC:
+                rpc_call(step->text, RPC_OWNER_SCRIPT);  // waits only while --rpc-depth requests are out
+                break;
+            case SCRIPT_OP_RPC_WAIT:
+            {
+                int failed = rpc_script_wait();
+                if (failed)
+                {
+                    fprintf(stderr, "[script] line %d: %d rpc requests failed\n", step->line, failed);
+                    if (step->target[0] < 0)
+                    {
+                        return 2;  // like an unhandled expect timeout
+                    }
+                    pc = step->target[0];
+                }
+                break;
+            }
+        }
+    }
+    tcdrain(uart_fd);
+    return E_OK;
+}
+
+// Function to keep received data for the next expect of the script
+void rx_script(struct rx_subscriber *sub, const char *data, int len)
+{
+    pthread_mutex_lock(&script.lock);
+    for (int i = 0; i < len; i++)
+    {
+        script.rx[script.rx_head++ % SCRIPT_RX_BUF] = data[i];
+    }
+    if (script.rx_head - script.rx_tail > SCRIPT_RX_BUF)
+    {
+        // nobody expected for a long time, the oldest bytes are gone
+        script.rx_drops += script.rx_head - SCRIPT_RX_BUF - script.rx_tail;
+        script.rx_tail = script.rx_head - SCRIPT_RX_BUF;
+    }
+    pthread_cond_signal(&script.more);
+    pthread_mutex_unlock(&script.lock);
+}
+
+// Function to find the longest literal every match of a regex must contain
+int regex_required_literal(const char *regex, char *out, int size)
+{
+    char run[TRIGGER_LINE];
+    int run_len = 0, best = 0, depth = 0;
+
+    if (strchr(regex, '|'))
+    {
+        return 0;  // alternation: no single literal is required
+    }
+    for (const char *p = regex; ; p++)
+    {
+        char c = *p;
+        int plain = c && depth == 0 && !strchr(".[]()*+?{}|^$\\", c);
+        int optional = plain && p[1] && strchr("*?{", p[1]);  // "ab*" only requires "a"
+
+        if (c == '[' || c == '(')
+        {
+            depth++;  // classes and groups are not literal
+        }
+        else if ((c == ']' || c == ')') && depth > 0)
+        {
+            depth--;
+        }
+
+        if (plain && !optional && run_len < (int)sizeof(run) - 1)
+        {
+            run[run_len++] = c;
+            if (p[1] == '+')
+            {
+                plain = 0;  // "ab+c": the run ends after the first b
+            }
+        }
+        if (!plain || optional || c == '\0')
+        {
+            if (run_len > best && run_len < size)
+            {
+                memcpy(out, run, run_len);
+                out[run_len] = '\0';
+                best = run_len;
+            }
+            run_len = 0;
+        }
+        if (c == '\0')
+        {
+            break;
+        }
+        if (c == '\\' && p[1])
+        {
+            p++;  // escaped character: skip, keeps the code simple
+        }
+    }
+    return best >= 3 ? best : 0;  // shorter literals would gate almost every line
+}
+
+// Function to load the trigger file and compile its regexes, the automaton is built later by trigger_compile()
+StdReturn trigger_load(const char *file)
+{
+    static const char *actions[] = { "highlight", "mark", "capture", "run" };
+    char line[1024], word[BUF_SIZE];
+    int line_no = 0, quoted;
+
+    FILE *in = fopen(file, "r");
+    if (in == NULL)
+    {
+        perror("Error opening trigger file");
+        return E_NOK;
+    }
+
+    while (fgets(line, sizeof(line), in) && trig.count < TRIGGERS_MAX)
+    {
+        char *cursor = line;
+        struct trigger *t = &trig.list[trig.count];
+        int action = -1, len;
+
+        line_no++;
+        if (script_token(&cursor, word, sizeof(word), &quoted) < 0)
+        {
+            continue;  // empty line or comment
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            if (strcmp(word, actions[i]) == 0)
+            {
+                action = i;
+            }
+        }
+
+        memset(t, 0, sizeof(*t));
+        len = script_token(&cursor, word, sizeof(word), &quoted);
+        if (len >= 0 && !quoted && strcmp(word, "regex") == 0)
+        {
+            t->is_regex = 1;
+            len = script_token(&cursor, word, sizeof(word), &quoted);
+        }
+        if (action < 0 || len <= 0 || !quoted)
+        {
+            fprintf(stderr, "%s:%d: expected <highlight|mark|capture|run> [regex] \"pattern\" [argument]\n", file, line_no);
+            fclose(in);
+            return E_NOK;
+        }
+        t->action = action;
+        t->pattern = strdup(word);
+        t->length = len;
+        if (script_token(&cursor, word, sizeof(word), &quoted) > 0)
+        {
+            t->argument = strdup(word);
+        }
+        if ((action == TRIGGER_CAPTURE || action == TRIGGER_RUN) && t->argument == NULL)
+        {
+            fprintf(stderr, "%s:%d: %s needs an argument\n", file, line_no, actions[action]);
+            fclose(in);
+            return E_NOK;
+        }
+        // a typo in a regex is reported now, not after the shell is already running
+        if (t->is_regex && regcomp(&t->regex, t->pattern, REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            fprintf(stderr, "%s:%d: invalid regex %s\n", file, line_no, t->pattern);
+            fclose(in);
+            return E_NOK;
+        }
+        trig.count++;
+    }
+    fclose(in);
+    return E_OK;
+}
+
+// Function to compile all literals, regex required literals included, into one automaton
+StdReturn trigger_compile(void)
+{
+    char literal[BUF_SIZE];
+    char *patterns[TRIGGERS_MAX];
+    int lengths[TRIGGERS_MAX];
+    int literals = 0, len;
+
+    trig.owner = malloc(TRIGGERS_MAX * sizeof(int));
+    if (trig.owner == NULL)
+    {
+        return E_NOK;
+    }
+    for (int i = 0; i < trig.count; i++)
+    {
+        struct trigger *t = &trig.list[i];
+        if (t->is_regex)
+        {
+            // regexec only runs on lines that contain the literal the regex can not match without
+            len = regex_required_literal(t->pattern, literal, sizeof(literal));
+            if (len > 0)
+            {
+                t->literal = 1;
+                patterns[literals] = strdup(literal);
+                lengths[literals] = len;
+                trig.owner[literals++] = i;
+            }
+        }
+        else
+        {
+            patterns[literals] = t->pattern;
+            lengths[literals] = t->length;
+            trig.owner[literals++] = i;
+        }
+    }
+
+    if (ac_compile(&trig.ac, patterns, lengths, literals) != E_OK)
+    {
+        fprintf(stderr, "Error compiling triggers\n");
+        return E_NOK;
+    }
+
+    // bytes that move the automaton away from the root: everything else can be skipped in bulk
+    for (int c = 0; c < 256; c++)
+    {
+        if (trig.ac.next[c] != 0 || c == '\n')
+        {
+            trig.start[c >> 3] |= 1 << (c & 7);
+            trig.lo_nibble[c & 15] |= 1 << ((c >> 4) & 7);  // high nibbles share 8 buckets, the
+            trig.hi_nibble[c >> 4] |= 1 << ((c >> 4) & 7);  // false positives are rechecked
+        }
+    }
+#if defined(__x86_64__)
+    trig.have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+    fprintf(stderr, "%d triggers loaded (%d literals, %d automaton states)\n", trig.count, literals, trig.ac.states);
+    return E_OK;
+}
+
+// Function to compile the triggers in the background, so startup does not wait for a large list
+void* trigger_compile_thread(void* arg)
+{
+    int ready = (trigger_compile() == E_OK) ? 1 : -1;
+
+    startup.triggers_us = monotonic_us();
+    pthread_mutex_lock(&trig.lock);
+    __atomic_store_n(&trig.ready, ready, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&trig.compiled);
+    pthread_mutex_unlock(&trig.lock);
+    return NULL;
+}
+
+// Function to find the first byte that may start a match (portable version)
+int trigger_skip(const unsigned char *data, int len)
+{
+    int i = 0;
+    while (i < len && !(trig.start[data[i] >> 3] & (1 << (data[i] & 7))))
+    {
+        i++;
+    }
+    return i;
+}
+
+// Function to find the first byte that may start a match, 16 bytes per step
+#if defined(__x86_64__)
+__attribute__((target("ssse3")))
+int trigger_skip_ssse3(const unsigned char *data, int len)
+{
+    const __m128i lo = _mm_loadu_si128((const __m128i *)trig.lo_nibble);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)trig.hi_nibble);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        int none = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128()));
+        if (none != 0xffff)
+        {
+            int hit = trigger_skip(data + i, 16);  // exact check, the buckets may report false positives
+            if (hit < 16)
+            {
+                return i + hit;
+            }
+        }
+    }
+    return i + trigger_skip(data + i, len - i);
+}
+#else
+int trigger_skip_ssse3(const unsigned char *data, int len)
+{
+    return trigger_skip(data, len);
+}
+#endif
+
+// Function to execute the action of a trigger that fired
+void trigger_fire(struct trigger *t, const char *line, int len)
+{
+    long long now = monotonic_ms();
+    int shell = !mux_mode && !net_mode && !pipe_mode && !script_file;
+    FILE *out = shell ? stdout : stderr;
+
+    t->hits++;
+    if (shell)
+    {
+        clear_prompt();
+    }
+    switch (t->action)
+    {
+        case TRIGGER_HIGHLIGHT:
+            fprintf(out, "\033[1;41m[%s]\033[0m \033[1;31m%.*s\033[0m\n", t->pattern, len, line);
+            break;
+        case TRIGGER_MARK:
+        {
+            struct timespec wall;
+            struct tm tm;
+            clock_gettime(CLOCK_REALTIME, &wall);
+            localtime_r(&wall.tv_sec, &tm);
+            fprintf(out, "\033[1;33m[mark %02d:%02d:%02d.%03ld]\033[0m %s\n",
+                    tm.tm_hour, tm.tm_min, tm.tm_sec, wall.tv_nsec / 1000000, t->pattern);
+            break;
+        }
+        case TRIGGER_CAPTURE:
+        {
+            int found = 0;
+            pthread_mutex_lock(&rx.lock);
+            for (int i = 0; i < RX_SUBSCRIBERS; i++)
+            {
+                found |= rx.subs[i].used && !rx.subs[i].stop && strcmp(rx.subs[i].name, t->argument) == 0;
+            }
+            pthread_mutex_unlock(&rx.lock);
+            if (!found)  // already capturing: keep the running file
+            {
+                // the file gets the line so far, the rest of this slab, then every slab after it
+                int fd = open(t->argument, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+                if (fd >= 0 && write(fd, line, len) == len && write(fd, trig.rest, trig.rest_len) == trig.rest_len
+                    && rx_subscribe_from(t->argument, rx_capture_policy, fd, rx_capture, trig.sub->cursor))
+                {
+                    fprintf(out, "\033[1;33m[%s]\033[0m capture started to %s\n", t->pattern, t->argument);
+                }
+                else if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+            break;
+        }
+        case TRIGGER_RUN:
+            if (t->last_ms == 0 || now - t->last_ms >= 1000)  // a log storm must not fork-bomb the host
+            {
+                // the environment is built before fork(): the child of a threaded process may only
+                // call async-signal-safe functions, setenv() could wait for a malloc lock forever
+                int count = 0, keep = 0;
+                while (environ[count])
+                {
+                    count++;
+                }
+                char **envp = malloc((count + 3) * sizeof(char *));
+                char *pattern_var = malloc(strlen(t->pattern) + sizeof("TRIGGER_PATTERN="));
+                char *line_var = malloc(len + sizeof("TRIGGER_LINE="));
+                if (envp == NULL || pattern_var == NULL || line_var == NULL)
+                {
+                    free(envp);
+                    free(pattern_var);
+                    free(line_var);
+                    break;
+                }
+                sprintf(pattern_var, "TRIGGER_PATTERN=%s", t->pattern);
+                memcpy(line_var, "TRIGGER_LINE=", sizeof("TRIGGER_LINE=") - 1);
+                memcpy(line_var + sizeof("TRIGGER_LINE=") - 1, line, len);
+                line_var[sizeof("TRIGGER_LINE=") - 1 + len] = '\0';
+                for (int i = 0; i < count; i++)
+                {
+                    if (strncmp(environ[i], "TRIGGER_PATTERN=", 16) != 0 && strncmp(environ[i], "TRIGGER_LINE=", 13) != 0)
+                    {
+                        envp[keep++] = environ[i];
+                    }
+                }
+                envp[keep++] = pattern_var;
+                envp[keep++] = line_var;
+                envp[keep] = NULL;
+
+                pid_t pid = fork();
+                if (pid == 0)
+                {
+                    sigset_t none;
+                    sigemptyset(&none);
+                    sigprocmask(SIG_SETMASK, &none, NULL);  // the mask of the threads is inherited, Ctrl+C must reach the command
+                    execle("/bin/sh", "sh", "-c", t->argument, (char *)NULL, envp);
+                    _exit(127);
+                }
+                free(envp);
+                free(pattern_var);
+                free(line_var);
+                fprintf(out, "\033[1;33m[%s]\033[0m ran %s\n", t->pattern, t->argument);
+            }
+            break;
+    }
+    if (shell)
+    {
+        redraw_prompt();
+    }
+    fflush(out);
+    t->last_ms = now;
+}
+
+// Function to run the regexes and show the highlights of the line that just ended
+void trigger_end_line(void)
+{
+    int len = trig.line_len;
+    while (len > 0 && (trig.line[len - 1] == '\n' || trig.line[len - 1] == '\r'))
+    {
+        len--;  // the line end is not part of the text shown or matched
+    }
+    trig.line[len] = '\0';
+    for (int i = 0; i < trig.count; i++)
+    {
+        struct trigger *t = &trig.list[i];
+        if (!t->is_regex && t->pending)
+        {
+            trigger_fire(t, trig.line, len);  // a literal highlight, once per line
+            t->pending = 0;
+        }
+        else if (t->is_regex && (t->pending || !t->literal))
+        {
+            if (regexec(&t->regex, trig.line, 0, NULL, 0) == 0)
+            {
+                trigger_fire(t, trig.line, len);
+            }
+            t->pending = 0;
+        }
+    }
+    trig.line_len = 0;
+}
+
+// Function to scan received data for all triggers
+void rx_trigger(struct rx_subscriber *sub, const char *data, int len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    int i = 0;
+
+    if (__atomic_load_n(&trig.ready, __ATOMIC_ACQUIRE) == 0)
+    {
+        // data that arrives while compiling waits in the ring, nothing is scanned twice or missed
+        pthread_mutex_lock(&trig.lock);
+        while (trig.ready == 0)
+        {
+            pthread_cond_wait(&trig.compiled, &trig.lock);
+        }
+        pthread_mutex_unlock(&trig.lock);
+    }
+    if (trig.ready < 0)
+    {
+        return;
+    }
+    trig.sub = sub;
+    trig.bytes += len;
+    while (i < len)
+    {
+        if (trig.state == 0)
+        {
+            // at the root nothing is partially matched: jump to the next interesting byte
+            int skip = trig.have_ssse3 ? trigger_skip_ssse3(bytes + i, len - i) : trigger_skip(bytes + i, len - i);
+            int room = TRIGGER_LINE - trig.line_len;
+            memcpy(trig.line + trig.line_len, bytes + i, skip < room ? skip : room);
+            trig.line_len += skip < room ? skip : room;
+            trig.skipped += skip;
+            i += skip;
+            if (i == len)
+            {
+                break;
+            }
+        }
+
+        unsigned char c = bytes[i++];
+        if (trig.line_len == TRIGGER_LINE)
+        {
+            trigger_end_line();  // overlong line: evaluate what we have
+        }
+        trig.line[trig.line_len++] = c;
+        trig.state = trig.ac.next[trig.state * 256 + c];
+
+        // every pattern ending here: the state own one and the ones on its dictionary chain,
+        // each with the triggers that share its literal
+        for (int s = (trig.ac.own[trig.state] >= 0) ? trig.state : trig.ac.dict[trig.state]; s >= 0; s = trig.ac.dict[s])
+        {
+            for (int p = trig.ac.own[s]; p >= 0; p = trig.ac.same[p])
+            {
+                struct trigger *t = &trig.list[trig.owner[p]];
+                if (t->is_regex || t->action == TRIGGER_HIGHLIGHT)
+                {
+                    t->pending = 1;  // regexec confirms it, a highlight shows the whole line: at the end of the line
+                }
+                else
+                {
+                    trig.rest = data + i;
+                    trig.rest_len = len - i;
+                    trigger_fire(t, trig.line, trig.line_len);
+                }
+            }
+        }
+
+        if (c == '\n')
+        {
+            trigger_end_line();
+        }
+    }
+}
+
+// Function to list the triggers and their hits (triggers command)
+void print_triggers(void)
+{
+    static const char *actions[] = { "highlight", "mark", "capture", "run" };
+    int ready = __atomic_load_n(&trig.ready, __ATOMIC_ACQUIRE);
+    if (ready <= 0)
+    {
+        printf("%d triggers %s\n", trig.count, ready ? "not compiled, disabled" : "still compiling");
+        return;
+    }
+    for (int i = 0; i < trig.count; i++)
+    {
+        struct trigger *t = &trig.list[i];
+        printf("%-9s %s\"%s\" %s: %llu hits\n", actions[t->action], t->is_regex ? "regex " : "",
+               t->pattern, t->argument ? t->argument : "", t->hits);
+    }
+    printf("%llu bytes scanned, %llu skipped by the prefilter (%s)\n", trig.bytes, trig.skipped,
+           trig.have_ssse3 ? "ssse3" : "scalar");
+}
+
+// Function to turn \r \n \t \xHH escapes of an option into bytes, returns the length
+int rpc_unescape(const char *text, char *out, int size)
+{
+    char quoted[RPC_LINE + 2];
+    char *cursor = quoted;
+    int is_quoted;
+    snprintf(quoted, sizeof(quoted), "\"%s\"", text);  // the script reader handles escapes in quotes
+    int len = script_token(&cursor, out, size, &is_quoted);
+    return len < 0 ? 0 : len;
+}
+
+// Function to start the RPC layer: response matching, timeouts and the socket API
+StdReturn rpc_start(void)
+{
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.started)
+    {
+        pthread_mutex_unlock(&rpc.lock);
+        return E_OK;
+    }
+    for (int i = 0; i < RPC_CLIENTS; i++)
+    {
+        rpc.clients[i].fd = -1;
+    }
+    rpc.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (rpc.socket_path)
+    {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", rpc.socket_path);
+        unlink(rpc.socket_path);  // left over by an earlier run
+        rpc.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (rpc.listen_fd < 0 || bind(rpc.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(rpc.listen_fd, RPC_CLIENTS) != 0)
+        {
+            perror("Error opening the RPC socket");
+            pthread_mutex_unlock(&rpc.lock);
+            return E_NOK;
+        }
+    }
+    if (rpc.wake_fd < 0 || rx_subscribe("rpc", RX_POLICY_BLOCK, -1, rx_rpc) == NULL
+        || pthread_create(&rpc_tid, NULL, rpc_thread, NULL) != 0)
+    {
+        perror("Error starting the RPC layer");
+        pthread_mutex_unlock(&rpc.lock);
+        return E_NOK;
+    }
+    rpc.started = 1;
+    pthread_mutex_unlock(&rpc.lock);
+    return E_OK;
+}
+
+// Function to send one command as a request, rpc.lock held (released during the write) and a slot free
+void rpc_submit(const char *command, int owner, unsigned long long number)
+{
+    char out[RPC_LINE + 64];
+    int len = 0, slot = 0, key_len = strcspn(command, " =?");
+    unsigned long long seq;
+    long long sent_us;
+
+    while (rpc.req[slot].used)
+    {
+        slot++;
+    }
+    struct rpc_request *req = &rpc.req[slot];
+    req->used = 1;
+    req->seq = seq = rpc.next_seq++;
+    req->owner = owner;
+    req->number = number;
+    req->response_len = 0;
+    snprintf(req->command, sizeof(req->command), "%s", command);
+
+    // latencies are kept per command name: AT+CSQ, AT+CSQ? and AT+CSQ=1 count together
+    req->key = -1;
+    for (int i = 0; i < rpc.key_count && req->key < 0; i++)
+    {
+        if ((int)strlen(rpc.keys[i].name) == key_len && strncmp(rpc.keys[i].name, command, key_len) == 0)
+        {
+            req->key = i;
+        }
+    }
+    if (req->key < 0)
+    {
+        req->key = rpc.key_count < RPC_KEYS ? rpc.key_count++ : RPC_KEYS - 1;  // the last one takes the rest
+        if (rpc.keys[req->key].name[0] == '\0')
+        {
+            snprintf(rpc.keys[req->key].name, sizeof(rpc.keys[req->key].name), "%.*s",
+                     req->key == RPC_KEYS - 1 ? 7 : key_len, req->key == RPC_KEYS - 1 ? "(other)" : command);
+        }
+    }
+    if (owner == RPC_OWNER_SCRIPT)
+    {
+        rpc.script_outstanding++;
+    }
+    else if (owner >= 0)
+    {
+        rpc.clients[owner].pending++;
+    }
+    rpc.outstanding++;
+
+    if (rpc.tag)
+    {
+        len = snprintf(out, sizeof(out), "%s%llu ", rpc.tag, seq);
+    }
+    len += snprintf(out + len, sizeof(out) - len, "%s", command);
+    memcpy(out + len, rpc.eol, rpc.eol_len);
+    len += rpc.eol_len;
+    req->sent_us = 0;  // stamped right before the write, it can not time out while it waits for the UART
+
+    // the answers are matched without waiting for the UART: the commands go out in seq order,
+    // with in order matching the wire order is the answer order
+    pthread_mutex_unlock(&rpc.lock);
+    pthread_mutex_lock(&rpc.tx_lock);
+    while (rpc.tx_seq != seq)
+    {
+        pthread_cond_wait(&rpc.tx_turn, &rpc.tx_lock);
+    }
+    tx_direct_begin();  // not between the data bytes of a T<<, that may take a while
+    pthread_mutex_lock(&rpc.lock);
+    sent_us = monotonic_us();
+    for (int i = 0; i < RPC_DEPTH_MAX; i++)
+    {
+        if (rpc.req[i].used && rpc.req[i].seq == seq)
+        {
+            rpc.req[i].sent_us = sent_us;
+            rpc.req[i].deadline_us = sent_us + rpc.timeout_ms * 1000LL;
+        }
+    }
+    pthread_mutex_unlock(&rpc.lock);
+    if (write(rpc.wake_fd, &(unsigned long long){ 1 }, sizeof(unsigned long long)) < 0)
+    {
+        // nothing: the thread is awake already, it takes the new deadline into account
+    }
+    write_uart_len(out, len);  // not queued behind the tx scheduler
+    tx_direct_end();
+    rpc.tx_seq++;
+    pthread_cond_broadcast(&rpc.tx_turn);
+    pthread_mutex_unlock(&rpc.tx_lock);
+    if (scroll.size)
+    {
+        scroll_add(SCROLL_TX, out, len - rpc.eol_len, sent_us);
+    }
+    pthread_mutex_lock(&rpc.lock);
+}
+
+// Function to send one command as a request, waiting until fewer than --rpc-depth are outstanding
+void rpc_call(const char *command, int owner)
+{
+    pthread_mutex_lock(&rpc.lock);
+    while (rpc.outstanding >= rpc.depth)
+    {
+        pthread_cond_wait(&rpc.room, &rpc.lock);
+    }
+    rpc_submit(command, owner, 0);
+    pthread_mutex_unlock(&rpc.lock);
+}
+
+// Function to finish a request: statistics, answer to its owner, slot free again (rpc.lock held)
+void rpc_finish(struct rpc_request *req, const char *end, int status, long long us)
+{
+    long long took_us = req->sent_us ? us - req->sent_us : 0;  // 0: matched before it was written
+    struct rpc_key *key = &rpc.keys[req->key];
+    const char *result = status == RPC_TIMEOUT ? "TIMEOUT" : end;
+
+    key->count++;
+    key->errors += (status == RPC_ERROR);
+    key->timeouts += (status == RPC_TIMEOUT);
+    if (status != RPC_TIMEOUT)
+    {
+        int bucket = 0;
+        while (took_us >= bench_limits[bucket])
+        {
+            bucket++;
+        }
+        key->histogram[bucket]++;
+        key->min_us = (key->count - key->timeouts == 1 || took_us < key->min_us) ? took_us : key->min_us;
+        key->max_us = took_us > key->max_us ? took_us : key->max_us;
+        key->sum_us += took_us;
+    }
+
+    if (req->owner == RPC_OWNER_SHELL)
+    {
+        port_notice("rpc", "%s: %s in %lld us", req->command, result, took_us);
+    }
+    else if (req->owner == RPC_OWNER_SCRIPT)
+    {
+        fprintf(stderr, "[script] rpc %s: %s in %lld us\n", req->command, result, took_us);
+        rpc.script_outstanding--;
+        rpc.script_failed += (status != RPC_OK);
+    }
+    else if (req->owner >= 0)
+    {
+        // SMTP style: "<n>-<line>" per response line, "<n> <terminator> <us> us" at the end
+        char answer[RPC_RESPONSE * 2 + RPC_LINE];
+        int len = 0;
+        for (char *line = req->response; line < req->response + req->response_len; )
+        {
+            char *nl = memchr(line, '\n', req->response + req->response_len - line);
+            len += snprintf(answer + len, sizeof(answer) - len, "%llu-%.*s\n", req->number, (int)(nl - line), line);
+            line = nl + 1;
+        }
+        len += snprintf(answer + len, sizeof(answer) - len, "%llu %s %lld us\n", req->number, result, took_us);
+        struct rpc_client *client = &rpc.clients[req->owner];
+        client->pending--;
+        if (send(client->fd, answer, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len)
+        {
+            client->broken = 1;  // does not read its answers, the thread closes it
+        }
+    }
+
+    req->used = 0;
+    rpc.outstanding--;
+    pthread_cond_broadcast(&rpc.room);
+    if (write(rpc.wake_fd, &(unsigned long long){ 1 }, sizeof(unsigned long long)) < 0)
+    {
+        // nothing: the counter is full of wakeups already
+    }
+}
+
+// Function to give one received line to the request it belongs to
+void rpc_line(char *line, int len, long long us)
+{
+    struct rpc_request *req = NULL;
+    char *text = line;
+
+    pthread_mutex_lock(&rpc.lock);
+    if (rpc.tag)
+    {
+        // "<tag><n> text" belongs to request n, lines without the tag are not answers
+        int tag_len = strlen(rpc.tag);
+        char *end;
+        if (strncmp(line, rpc.tag, tag_len) == 0)
+        {
+            unsigned long long seq = strtoull(line + tag_len, &end, 10);
+            for (int i = 0; i < RPC_DEPTH_MAX && req == NULL && end != line + tag_len; i++)
+            {
+                if (rpc.req[i].used && rpc.req[i].seq == seq)
+                {
+                    req = &rpc.req[i];
+                }
+            }
+            text = end + (*end == ' ');
+        }
+    }
+    else
+    {
+        // in order: the oldest request gets the line
+        for (int i = 0; i < RPC_DEPTH_MAX; i++)
+        {
+            if (rpc.req[i].used && (req == NULL || rpc.req[i].seq < req->seq))
+            {
+                req = &rpc.req[i];
+            }
+        }
+    }
+
+    if (req)
+    {
+        int status = -1;
+        for (int i = 0; i < rpc.end_count && status < 0; i++)
+        {
+            if (strncmp(text, rpc.ends[i], strlen(rpc.ends[i])) == 0)
+            {
+                status = i == 0 ? RPC_OK : RPC_ERROR;
+            }
+        }
+        if (status >= 0)
+        {
+            rpc_finish(req, text, status, us);
+        }
+        else if (req->response_len + (line + len - text) + 1 <= RPC_RESPONSE)
+        {
+            memcpy(req->response + req->response_len, text, line + len - text);
+            req->response_len += line + len - text;
+            req->response[req->response_len++] = '\n';
+        }
+    }
+    pthread_mutex_unlock(&rpc.lock);
+}
+
+// Function to cut the received data into lines for the RPC layer
+void rx_rpc(struct rx_subscriber *sub, const char *data, int len)
+{
+    // only this thread touches the line buffer
+    for (int i = 0; i < len; i++)
+    {
+        if (data[i] == '\n')
+        {
+            while (rpc.line_len && rpc.line[rpc.line_len - 1] == '\r')
+            {
+                rpc.line_len--;
+            }
+            rpc.line[rpc.line_len] = '\0';
+            if (rpc.line_len)
+            {
+                rpc_line(rpc.line, rpc.line_len, sub->slab_us);  // timed by the read that brought the end
+            }
+            rpc.line_len = 0;
+        }
+        else if (rpc.line_len < RPC_LINE - 1)
+        {
+            rpc.line[rpc.line_len++] = data[i];
+        }
+    }
+}
+
+// Function to wait for the answers to the requests of the script, returns how many failed
+int rpc_script_wait(void)
+{
+    pthread_mutex_lock(&rpc.lock);
+    while (rpc.script_outstanding)
+    {
+        pthread_cond_wait(&rpc.room, &rpc.lock);
+    }
+    int failed = rpc.script_failed;
+    rpc.script_failed = 0;
+    pthread_mutex_unlock(&rpc.lock);
+    return failed;
+}
+
+// Function to print the requests and latency histograms per command (rpc.lock held)
+void rpc_report(FILE *out)
+{
+    fprintf(out, "rpc: %d outstanding of %d, %s, timeout %d ms\n", rpc.outstanding, rpc.depth,
+            rpc.tag ? "tagged" : "in order", rpc.timeout_ms);
+    for (int i = 0; i < rpc.key_count; i++)
+    {
+        struct rpc_key *key = &rpc.keys[i];
+        unsigned long long answered = key->count - key->timeouts;
+        fprintf(out, "%-16s %llu requests, %llu errors, %llu timeouts", key->name, key->count, key->errors, key->timeouts);
+        if (answered)
+        {
+            fprintf(out, ", min %lld us, avg %lld us, max %lld us\n ", key->min_us,
+                    key->sum_us / (long long)answered, key->max_us);
+            for (int bucket = 0; bucket < BENCH_BUCKETS; bucket++)
+            {
+                if (key->histogram[bucket] && bench_limits[bucket] != INT_MAX)
+                {
+                    fprintf(out, " <%d us: %d", bench_limits[bucket], key->histogram[bucket]);
+                }
+                else if (key->histogram[bucket])
+                {
+                    fprintf(out, " more: %d", key->histogram[bucket]);
+                }
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+// Function to print the requests and latency histograms per command (rpc command)
+void print_rpc(void)
+{
+    pthread_mutex_lock(&rpc.lock);
+    rpc_report(stdout);
+    pthread_mutex_unlock(&rpc.lock);
+}
+
+// Function to send the commands a connection sent while there is room for them (rpc.lock held, see rpc_submit)
+void rpc_client_lines(int slot)
+{
+    struct rpc_client *client = &rpc.clients[slot];
+    char *nl;
+
+    while (client->fd >= 0 && rpc.outstanding < rpc.depth && (nl = memchr(client->in, '\n', client->in_len)))
+    {
+        int len = nl - client->in;
+        *nl = '\0';
+        while (len && client->in[len - 1] == '\r')
+        {
+            client->in[--len] = '\0';
+        }
+        if (len && strcmp(client->in, ".stats") == 0)
+        {
+            if (client->pending)
+            {
+                *nl = '\n';
+                break;  // after the answers to the commands before it
+            }
+            // the histograms for the script on the other end, ended by a line with a single dot
+            char *text = NULL;
+            size_t size = 0;
+            FILE *report = open_memstream(&text, &size);
+            if (report)
+            {
+                rpc_report(report);
+                fprintf(report, ".\n");
+                fclose(report);
+                if (send(client->fd, text, size, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)size)
+                {
+                    client->broken = 1;
+                }
+                free(text);
+            }
+        }
+        else if (len)
+        {
+            char command[RPC_LINE];
+            memcpy(command, client->in, len + 1);
+            client->in_len -= nl + 1 - client->in;
+            memmove(client->in, nl + 1, client->in_len);
+            rpc_submit(command, slot, ++client->requests);  // releases rpc.lock while it writes
+            continue;
+        }
+        client->in_len -= nl + 1 - client->in;
+        memmove(client->in, nl + 1, client->in_len);
+    }
+}
+
+// Function to close a connection, its requests are still answered on the wire (rpc.lock held)
+void rpc_client_close(int slot)
+{
+    for (int j = 0; j < RPC_DEPTH_MAX; j++)
+    {
+        if (rpc.req[j].used && rpc.req[j].owner == slot)
+        {
+            rpc.req[j].owner = RPC_OWNER_NONE;  // nobody to tell
+        }
+    }
+    close(rpc.clients[slot].fd);
+    rpc.clients[slot].fd = -1;
+}
+
+// Function to run the socket API and fail the requests that were not answered in time
+void* rpc_thread(void* arg)
+{
+    struct pollfd fds[RPC_CLIENTS + 2];
+
+    while (1)
+    {
+        long long now = monotonic_us(), next = -1;
+
+        pthread_mutex_lock(&rpc.lock);
+        for (int i = 0; i < RPC_DEPTH_MAX; i++)
+        {
+            struct rpc_request *req = &rpc.req[i];
+            if (req->used && req->sent_us && now >= req->deadline_us)
+            {
+                rpc_finish(req, NULL, RPC_TIMEOUT, now);
+            }
+            else if (req->used && req->sent_us && (next < 0 || req->deadline_us < next))
+            {
+                next = req->deadline_us;
+            }
+        }
+        fds[0].fd = rpc.wake_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = rpc.listen_fd;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < RPC_CLIENTS; i++)
+        {
+            struct rpc_client *client = &rpc.clients[i];
+            rpc_client_lines(i);
+            // a client that shut down its sending side (printf ... | socat) still gets all its answers
+            if (client->fd >= 0 && (client->broken
+                || (client->eof && client->pending == 0 && memchr(client->in, '\n', client->in_len) == NULL)))
+            {
+                rpc_client_close(i);
+            }
+            // commands stay in the socket while the pipeline is full, a finished client only waits
+            fds[i + 2].fd = client->eof ? -1 : client->fd;
+            fds[i + 2].events = (rpc.outstanding < rpc.depth && client->in_len < RPC_LINE) ? POLLIN : 0;
+        }
+        pthread_mutex_unlock(&rpc.lock);
+
+        if (poll(fds, RPC_CLIENTS + 2, next < 0 ? -1 : (int)((next - now) / 1000) + 1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error polling the RPC socket");
+            return NULL;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            unsigned long long count;
+            if (read(rpc.wake_fd, &count, sizeof(count)) < 0)
+            {
+                // nothing: the counter was drained by the previous round
+            }
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            int fd = accept4(rpc.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC), slot = -1;
+            pthread_mutex_lock(&rpc.lock);
+            for (int i = 0; i < RPC_CLIENTS && slot < 0 && fd >= 0; i++)
+            {
+                if (rpc.clients[i].fd < 0)
+                {
+                    slot = i;
+                }
+            }
+            if (slot >= 0)
+            {
+                memset(&rpc.clients[slot], 0, sizeof(rpc.clients[slot]));
+                rpc.clients[slot].fd = fd;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);  // all slots busy
+            }
+            pthread_mutex_unlock(&rpc.lock);
+        }
+
+        for (int i = 0; i < RPC_CLIENTS; i++)
+        {
+            struct rpc_client *client = &rpc.clients[i];
+            if (fds[i + 2].fd < 0 || !(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            // only this thread reads the connections and frees their slots
+            int n = read(client->fd, client->in + client->in_len, RPC_LINE - client->in_len);
+            pthread_mutex_lock(&rpc.lock);
+            if (n > 0)
+            {
+                client->in_len += n;
+                // a command longer than a line, the connection is not speaking this protocol
+                client->broken = (client->in_len == RPC_LINE && memchr(client->in, '\n', RPC_LINE) == NULL);
+            }
+            else if (n == 0)
+            {
+                // end of the commands: the buffered ones are still sent, the last may lack its newline
+                client->eof = 1;
+                if (client->in_len && client->in_len < RPC_LINE && client->in[client->in_len - 1] != '\n')
+                {
+                    client->in[client->in_len++] = '\n';
+                }
+            }
+            else if (errno != EAGAIN && errno != EINTR)
+            {
+                client->broken = 1;
+            }
+            pthread_mutex_unlock(&rpc.lock);
+        }
+    }
+    return NULL;
+}
+
+// Function to keep the busy reader within its CPU budget, blocking for the rest of a window if needed
+void busy_throttle(long long now)
+{
+    struct timespec cpu;
+
+    if (now - busy.last_check_us < 1000)
+    {
+        return;  // the thread CPU time is a system call, read it once per ms
+    }
+    busy.last_check_us = now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    long long cpu_us = cpu.tv_sec * 1000000LL + cpu.tv_nsec / 1000;
+    if (now - busy.window_us >= BUSY_WINDOW_MS * 1000)
+    {
+        busy.cpu_us += cpu_us - busy.window_cpu_us;
+        busy.window_us = now;
+        busy.window_cpu_us = cpu_us;
+    }
+    else if ((cpu_us - busy.window_cpu_us) * 100 >= (long long)busy.budget * BUSY_WINDOW_MS * 1000)
+    {
+        // budget of this window used up: wait event driven until the window ends
+        struct pollfd wait = { uart_fd, POLLIN, 0 };
+        busy.throttled++;
+        poll(&wait, 1, (busy.window_us + BUSY_WINDOW_MS * 1000 - now) / 1000 + 1);
+    }
+}
+
+// Function to read from the UART by calling a read that does not block until data arrives (--busy-poll)
+int read_busy(char *buf, int size)
+{
+    long long idle_since = monotonic_us();
+
+    while (1)
+    {
+        int n = read(uart_fd, buf, size);  // VMIN 0, VTIME 0: returns at once
+        // a lost port is /dev/null, that reads 0 bytes like a hangup, the caller waits for it
+        if (n != 0 || __atomic_load_n(&hotplug.lost, __ATOMIC_RELAXED))
+        {
+            busy.reads += (n > 0);
+            return n;
+        }
+        busy.empty++;
+        long long now = monotonic_us();
+        if (busy.budget < 100)
+        {
+            busy_throttle(now);
+        }
+        if (now - idle_since < BUSY_SPIN_US)
+        {
+#if defined(__x86_64__)
+            _mm_pause();  // lets the sibling hyperthread run and saves power while spinning
+#elif defined(__aarch64__)
+            __asm__ volatile("yield");
+#endif
+            continue;
+        }
+        // quiet for a while: a hangup also reads 0 bytes, only poll() tells them apart
+        struct pollfd hangup = { uart_fd, POLLIN, 0 };
+        if (poll(&hangup, 1, 0) > 0 && (hangup.revents & (POLLHUP | POLLERR)))
+        {
+            return 0;
+        }
+        sched_yield();
+        busy.yields++;
+    }
+}
+
+// Function to continuously read data from the UART and publish it to the subscribers
+void* read_uart(void* arg) 
+{
+    reader_realtime();
+    if (autobaud.keep_len)
+    {
+        // the text autobaud recognized the rate by is shown like any other received data
+        struct rx_slab *slab = rx_slab_alloc();
+        if (slab)
+        {
+            memcpy(slab->data, autobaud.keep, autobaud.keep_len);
+            slab->rx_us = monotonic_us();
+            slab->data[autobaud.keep_len] = '\0';
+            slab->len = autobaud.keep_len;
+            rx_publish(slab);
+        }
+    }
+    while (1) 
+    {
+        struct rx_slab *slab = rx_slab_alloc();
+        if (slab == NULL)
+        {
+            perror("Error allocating receive slab");
+            usleep(1000);
+            continue;
+        }
+
+        unsigned long long generation = __atomic_load_n(&hotplug.generation, __ATOMIC_RELAXED);
+        int read_bits = busy.enabled ? read_busy(slab->data, RX_SLAB_SIZE)
+                                     : read(uart_fd, slab->data, RX_SLAB_SIZE);  // Read from UART straight into the slab
+        if (read_bits > 0) 
+        {
+            read_bits = link_unmark(slab->data, read_bits);
+            if (read_bits == 0)
+            {
+                rx_slab_release(slab);  // only marks or a split mark sequence
+                continue;
+            }
+            __atomic_store_n(&health.rx_bytes, health.rx_bytes + read_bits, __ATOMIC_RELAXED);  // only this thread writes it
+            slab->rx_us = monotonic_us();  // lines are dated by the read that brought them
+            if (startup.first_rx_us == 0)
+            {
+                __atomic_store_n(&startup.first_rx_us, slab->rx_us, __ATOMIC_RELAXED);  // only this thread writes it
+            }
+            slab->data[read_bits] = '\0';  // Null-terminate the received data
+            slab->len = read_bits;
+            rx_publish(slab);
+            if (__atomic_load_n(&shut.stopping, __ATOMIC_RELAXED))
+            {
+                break;  // bytes that arrived before the shutdown are published, the drain delivers them
+            }
+        }
+        else if (read_bits == 0 || errno == EIO || errno == ENXIO || errno == ENODEV)
+        {
+            // hangup or unplugged: wait until the hotplug thread opened the port again
+            rx_slab_release(slab);
+            port_lost(generation);
+            port_wait();
+        }
+        else
+        {
+            if (errno != EINTR && errno != EAGAIN) 
+            {
+                perror("Error reading from UART\n");  // Print error if reading from UART fails
+                usleep(1000);  // Sleep for 1ms to prevent CPU overuse on a failing port
+            }
+            rx_slab_release(slab);
+        }
+    }
+    return E_OK;
+}
+
+// Function to load the history file and open it for appending
+void history_load(void)
+{
+    char path[BUF_SIZE * 2];
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    const char *home = getenv("HOME");
+
+    history.browse = history.count;
+    if (home == NULL)
+    {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+    FILE *file = fopen(path, "r");
+    if (file)
+    {
+        while ((len = getline(&line, &size, file)) > 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0])
+            {
+                char **slot = &history.lines[history.count++ % HISTORY_MAX];  // the newest HISTORY_MAX stay
+                free(*slot);
+                *slot = strdup(line);
+            }
+        }
+        free(line);
+        fclose(file);
+    }
+    history.browse = history.count;
+    history.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+}
+
+// Function to remember an entered line
+void history_add(const char *line)
+{
+    history.browse = history.count + 1;
+    if (history.count && strcmp(history.lines[(history.count - 1) % HISTORY_MAX], line) == 0)
+    {
+        history.browse = history.count;
+        return;  // repeating a command does not fill the history
+    }
+    char **slot = &history.lines[history.count++ % HISTORY_MAX];
+    free(*slot);
+    *slot = strdup(line);
+    if (history.fd >= 0)
+    {
+        dprintf(history.fd, "%s\n", line);
+    }
+}
+
+// Function to make room for a line of (size) bytes, terminator included
+StdReturn input_reserve(unsigned int size)
+{
+    StdReturn ret = E_OK;
+
+    if (size <= user_input_size)
+    {
+        return E_OK;
+    }
+    if (size > input_max + 1)
+    {
+        size = input_max + 1;
+        ret = E_NOK;
+    }
+    // doubling keeps the copies linear in the line length
+    unsigned int grown = user_input_size ? user_input_size : BUF_SIZE;
+    while (grown < size)
+    {
+        grown *= 2;
+    }
+    if (grown > input_max + 1)
+    {
+        grown = input_max + 1;
+    }
+    if (grown <= user_input_size)
+    {
+        return ret;
+    }
+    pthread_mutex_lock(&prompt_lock);
+    char *buf = realloc(user_input, grown);
+    if (buf)
+    {
+        if (user_input == NULL)
+        {
+            buf[0] = '\0';
+        }
+        user_input = buf;
+        user_input_size = grown;
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    return buf ? ret : E_NOK;
+}
+
+// Function to insert typed characters at the cursor
+void edit_insert(const char *text, int len)
+{
+    pthread_mutex_lock(&prompt_lock);  // a redraw sees the line before or after the insert
+    if (input_reserve(user_input_counter + len + 1) != E_OK)
+    {
+        len = user_input_size - 1 - user_input_counter;  // what still fits under --max-line
+        printf("\a");
+    }
+    if (len <= 0)
+    {
+        pthread_mutex_unlock(&prompt_lock);
+        return;
+    }
+    memmove(&user_input[edit_cursor + len], &user_input[edit_cursor], user_input_counter - edit_cursor + 1);
+    memcpy(&user_input[edit_cursor], text, len);
+    user_input_counter += len;
+
+    // the new characters and the tail they pushed right, then back to the insertion point
+    unsigned int tail = user_input_counter - edit_cursor - len;
+    printf("%s", &user_input[edit_cursor]);
+    if (tail)
+    {
+        printf("\033[%uD", tail);
+    }
+    edit_cursor += len;
+    fflush(stdout);
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Function to delete (count) characters starting at (from), the cursor ends at (from)
+void edit_delete(unsigned int from, unsigned int count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&prompt_lock);
+    edit_move(from);
+    memmove(&user_input[from], &user_input[from + count], user_input_counter - from - count + 1);
+    user_input_counter -= count;
+
+    // shift the tail left over the deleted characters and erase what is left behind
+    unsigned int tail = user_input_counter - from;
+    printf("%s\033[K", &user_input[from]);
+    if (tail)
+    {
+        printf("\033[%uD", tail);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Function to move the cursor within the line
+void edit_move(unsigned int to)
+{
+    pthread_mutex_lock(&prompt_lock);
+    if (to < edit_window)
+    {
+        // the start of a long line is not on the terminal, show the screen around (to) instead
+        clear_prompt();
+        edit_cursor = to;
+        redraw_prompt();
+        pthread_mutex_unlock(&prompt_lock);
+        return;
+    }
+    if (to < edit_cursor)
+    {
+        if (edit_cursor - to == 1)
+        {
+            printf("\b");
+        }
+        else
+        {
+            printf("\033[%uD", edit_cursor - to);
+        }
+    }
+    else if (to > edit_cursor)
+    {
+        printf("\033[%uC", to - edit_cursor);
+    }
+    edit_cursor = to;
+    fflush(stdout);
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Function to replace the whole line (history browsing)
+void edit_replace(const char *text)
+{
+    pthread_mutex_lock(&prompt_lock);
+    edit_move(0);
+    input_reserve(strlen(text) + 1);
+    snprintf(user_input, user_input_size, "%s", text);
+    user_input_counter = strlen(user_input);
+    edit_cursor = user_input_counter;
+    printf("%s\033[J", user_input);  // rows a longer line wrapped into are cleared too
+    fflush(stdout);
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Function to complete the command or the file path before the cursor (tab)
+void edit_complete(void)
+{
+    static const char *commands[] = { "R>>", "T<<", "R+", "R-", "R>shell", "R>", "T<",
+                                      "stats", "triggers", "search ", "grep ", "dtr ", "rts ", "modem", "bench", "rpc" };
+    char names[COMPLETE_MAX][BUF_SIZE];
+    int is_dir[COMPLETE_MAX] = { 0 };
+    int count = 0;
+    unsigned int word = 0;  // start of the text being completed
+
+    // R>, R>>, R+, T< and T<< are followed by a path, anything else is a command name
+    if (strncmp(user_input, "R>>", 3) == 0 || strncmp(user_input, "T<<", 3) == 0)
+    {
+        word = 3;
+    }
+    else if (strncmp(user_input, "R>", 2) == 0 || strncmp(user_input, "R+", 2) == 0
+             || strncmp(user_input, "T<", 2) == 0)
+    {
+        word = 2;
+    }
+    if (edit_cursor < word)
+    {
+        return;
+    }
+
+    char prefix[BUF_SIZE];
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)(edit_cursor - word), &user_input[word]);
+    unsigned int stem = 0;  // part of prefix the candidates start with
+    if (word == 0)
+    {
+        for (int i = 0; i < (int)(sizeof(commands) / sizeof(commands[0])); i++)
+        {
+            if (strncmp(commands[i], prefix, strlen(prefix)) == 0)
+            {
+                snprintf(names[count++], BUF_SIZE, "%s", commands[i]);
+            }
+        }
+        stem = strlen(prefix);
+    }
+    else
+    {
+        char dir[BUF_SIZE];
+        char *slash = strrchr(prefix, '/');
+        const char *base = slash ? slash + 1 : prefix;
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - prefix + 1) : 1, slash ? prefix : ".");
+        stem = strlen(base);
+
+        DIR *d = opendir(dir);
+        struct dirent *entry;
+        while (d && count < COMPLETE_MAX && (entry = readdir(d)) != NULL)
+        {
+            if (strncmp(entry->d_name, base, stem) != 0
+                || (entry->d_name[0] == '.' && base[0] != '.'))
+            {
+                continue;  // hidden files only when asked for
+            }
+            snprintf(names[count], BUF_SIZE, "%s", entry->d_name);
+            if (entry->d_type == DT_DIR)
+            {
+                is_dir[count] = 1;
+            }
+            else if (entry->d_type == DT_UNKNOWN)
+            {
+                char path[BUF_SIZE * 2];
+                struct stat st;
+                snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+                is_dir[count] = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+            }
+            count++;
+        }
+        if (d)
+        {
+            closedir(d);
+        }
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    // extend the word by what all candidates share
+    unsigned int common = strlen(names[0]);
+    for (int i = 1; i < count; i++)
+    {
+        unsigned int j = stem;
+        while (j < common && names[i][j] == names[0][j])
+        {
+            j++;
+        }
+        common = j;
+    }
+    if (common > stem)
+    {
+        edit_insert(&names[0][stem], common - stem);
+    }
+    if (count == 1)
+    {
+        if (is_dir[0])
+        {
+            edit_insert("/", 1);
+        }
+    }
+    else if (common == stem)
+    {
+        // nothing to add: show the choices under the line
+        clear_prompt();
+        for (int i = 0; i < count; i++)
+        {
+            printf("%s%s  ", names[i], is_dir[i] ? "/" : "");
+        }
+        printf("\n");
+        redraw_prompt();
+    }
+}
+
+// Function to take the next byte typed, reading a new chunk when needed
+int input_byte(void)
+{
+    if (input.pos == input.len)
+    {
+        int n = read(STDIN_FILENO, input.data, STDIN_CHUNK);
+        if (n <= 0)
+        {
+            return EOF;
+        }
+        input.len = n;
+        input.pos = 0;
+    }
+    return (unsigned char)input.data[input.pos++];
+}
+
+// Function to handle a chunk of pasted text, returns 1 when it ends the line like Enter
+int edit_paste(const char *text, int len)
+{
+    const char *last = memrchr(text, '\n', len);
+    static char line[PASTE_MAX];
+    int kept = 0;
+
+    if (last && (last != text + len - 1 || memchr(text, '\n', len) != last))
+    {
+        // several lines: the typed part and every complete pasted line go out as one block
+        char *block = malloc(user_input_counter + (last + 1 - text));
+        int block_len = user_input_counter;
+        if (block == NULL)
+        {
+            return 0;
+        }
+        memcpy(block, user_input, user_input_counter);
+        memcpy(&block[block_len], text, last + 1 - text);
+        block_len += last + 1 - text;
+
+        clear_prompt();
+        printf("\033[0;31msent->\033[0m%.*s", block_len, block);  // one echo for the whole block
+        paste_send(block, block_len);
+        free(block);
+        pthread_mutex_lock(&prompt_lock);
+        user_input_counter = edit_cursor = edit_window = 0;
+        user_input[0] = 0;
+        pthread_mutex_unlock(&prompt_lock);
+        printf(PROMPT);
+        len -= last + 1 - text;
+        text = last + 1;  // what follows the last newline stays on the line
+        last = NULL;
+    }
+
+    // the rest is inserted at the cursor with one echo, control characters dropped
+    for (int i = 0; i < len; i++)
+    {
+        if (((unsigned char)text[i] >= 32 && text[i] != 127) || text[i] == '\t')
+        {
+            line[kept++] = text[i];
+        }
+    }
+    if (kept)
+    {
+        edit_insert(line, kept);
+    }
+    return last != NULL && user_input_counter;  // a single line with its newline: like Enter
+}
+
+// Function to send pasted lines in one write, or line by line with --paste-delay
+void paste_send(const char *text, int len)
+{
+    long long now = monotonic_us();
+    int held = tx_resume_running();  // a T<< owns the UART: the lines wait in the queue like typed ones
+
+    if (paste_delay_ms <= 0 && !held)
+    {
+        write_uart_len(text, len);
+    }
+    while (len > 0)
+    {
+        const char *end = memchr(text, '\n', len);
+        int line_len = end ? end + 1 - text : len;
+        if (held)
+        {
+            tx_submit_line(text, line_len);  // adds the scrollback line too
+            text += line_len;
+            len -= line_len;
+            continue;
+        }
+        if (paste_delay_ms > 0)
+        {
+            write_uart_len(text, line_len);
+            tcdrain(uart_fd);
+            usleep(paste_delay_ms * 1000);  // the target processes the line before the next one
+        }
+        if (scroll.size)
+        {
+            scroll_add(SCROLL_TX, text, end ? line_len - 1 : line_len, now);
+        }
+        text += line_len;
+        len -= line_len;
+    }
+}
+
+// Function to read one key, escape sequences are returned as EDIT_KEY_* codes
+int edit_key(void)
+{
+    int c = input_byte();
+    if (c != 27)
+    {
+        return c;
+    }
+
+    // a terminal sends a whole sequence at once, a lone ESC must not wait for (and eat) the next key
+    if (input.pos == input.len)
+    {
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        if (poll(&pfd, 1, ESC_WAIT_MS) <= 0)
+        {
+            return c;  // plain ESC, ignored like the other control characters
+        }
+    }
+    c = input_byte();
+    if (c == 127 || c == '\b')
+    {
+        return EDIT_KEY_WORD_RUBOUT;  // Alt+Backspace
+    }
+    if (c == 'b' || c == 'f')
+    {
+        return c == 'b' ? EDIT_KEY_WORD_LEFT : EDIT_KEY_WORD_RIGHT;  // Alt+b / Alt+f
+    }
+    if (c != '[' && c != 'O')
+    {
+        return c == EOF ? EOF : 0;
+    }
+
+    // CSI / SS3: optional numeric parameters then one final byte
+    int param = 0, modifier = 0;
+    c = input_byte();
+    while ((c >= '0' && c <= '9') || c == ';')
+    {
+        if (c == ';')
+        {
+            modifier = 1;
+            param = param ? param : 1;
+        }
+        else if (!modifier)
+        {
+            param = param * 10 + (c - '0');
+        }
+        c = input_byte();
+    }
+    switch (c)
+    {
+        case 'A': return EDIT_KEY_UP;
+        case 'B': return EDIT_KEY_DOWN;
+        case 'C': return modifier ? EDIT_KEY_WORD_RIGHT : EDIT_KEY_RIGHT;  // Ctrl+Right
+        case 'D': return modifier ? EDIT_KEY_WORD_LEFT : EDIT_KEY_LEFT;
+        case 'H': return EDIT_KEY_HOME;
+        case 'F': return EDIT_KEY_END;
+        case '~':
+            switch (param)
+            {
+                case 1: case 7: return EDIT_KEY_HOME;
+                case 4: case 8: return EDIT_KEY_END;
+                case 3: return EDIT_KEY_DELETE;
+                case 200: return EDIT_KEY_PASTE;
+            }
+            return 0;
+    }
+    return c == EOF ? EOF : 0;  // unsupported sequence, ignored
+}
+
+// Function to edit a line until Enter is pressed on a non empty line
+StdReturn edit_line(void)
+{
+    static char paste[PASTE_MAX];
+
+    while (1)
+    {
+        if (input.pos == input.len)
+        {
+            int c = input_byte();  // wait for the next chunk
+            if (c == EOF)
+            {
+                return E_NOK;
+            }
+            input.pos--;
+        }
+
+        // several plain bytes in one read are a paste from a terminal without bracketed paste
+        int chunk = input.len - input.pos;
+        if (chunk > 1)
+        {
+            const char *text = &input.data[input.pos];
+            int plain = 1;
+            for (int i = 0; i < chunk && plain; i++)
+            {
+                plain = ((unsigned char)text[i] >= 32 && text[i] != 127)
+                        || text[i] == '\n' || text[i] == '\r' || text[i] == '\t';
+            }
+            if (plain)
+            {
+                input.pos = input.len;
+                if (edit_paste(text, chunk))
+                {
+                    return E_OK;
+                }
+                continue;
+            }
+        }
+
+        int key = edit_key();
+        unsigned int pos;
+
+        switch (key)
+        {
+            case EOF:
+                return E_NOK;
+            case EDIT_KEY_PASTE:
+                pos = 0;
+                while (1)
+                {
+                    int c = input_byte();
+                    if (c == EOF)
+                    {
+                        return E_NOK;
+                    }
+                    paste[pos++] = c;
+                    if (pos >= sizeof(PASTE_END) - 1
+                        && memcmp(&paste[pos - (sizeof(PASTE_END) - 1)], PASTE_END, sizeof(PASTE_END) - 1) == 0)
+                    {
+                        pos -= sizeof(PASTE_END) - 1;
+                        break;
+                    }
+                    if (pos == PASTE_MAX)
+                    {
+                        // longer than one block: handle it, keeping what may be the start of the end mark
+                        edit_paste(paste, pos - (sizeof(PASTE_END) - 2));
+                        memmove(paste, &paste[pos - (sizeof(PASTE_END) - 2)], sizeof(PASTE_END) - 2);
+                        pos = sizeof(PASTE_END) - 2;
+                    }
+                }
+                if (edit_paste(paste, pos))
+                {
+                    return E_OK;
+                }
+                break;
+            case '\n':
+            case '\r':
+                if (user_input_counter)  // If Enter was pressed without any input, do nothing
+                {
+                    return E_OK;
+                }
+                break;
+            case 127:  // Handle backspace
+            case '\b':
+                if (edit_cursor == user_input_counter && edit_cursor)
+                {
+                    pthread_mutex_lock(&prompt_lock);
+                    user_input[--user_input_counter] = 0;
+                    edit_cursor--;
+                    delete_chars(1);  // Delete the last character from the terminal
+                    fflush(stdout);
+                    pthread_mutex_unlock(&prompt_lock);
+                }
+                else if (edit_cursor)
+                {
+                    edit_delete(edit_cursor - 1, 1);
+                }
+                break;
+            case 4:  // Ctrl+D
+            case EDIT_KEY_DELETE:
+                if (edit_cursor < user_input_counter)
+                {
+                    edit_delete(edit_cursor, 1);
+                }
+                break;
+            case 1:  // Ctrl+A
+            case EDIT_KEY_HOME:
+                edit_move(0);
+                break;
+            case 5:  // Ctrl+E
+            case EDIT_KEY_END:
+                edit_move(user_input_counter);
+                break;
+            case 2:  // Ctrl+B
+            case EDIT_KEY_LEFT:
+                if (edit_cursor)
+                {
+                    edit_move(edit_cursor - 1);
+                }
+                break;
+            case 6:  // Ctrl+F
+            case EDIT_KEY_RIGHT:
+                if (edit_cursor < user_input_counter)
+                {
+                    pthread_mutex_lock(&prompt_lock);
+                    putchar(user_input[edit_cursor++]);  // one byte instead of a sequence
+                    fflush(stdout);
+                    pthread_mutex_unlock(&prompt_lock);
+                }
+                break;
+            case EDIT_KEY_WORD_LEFT:
+            case 23:  // Ctrl+W
+            case EDIT_KEY_WORD_RUBOUT:
+                pos = edit_cursor;
+                while (pos && user_input[pos - 1] == ' ')
+                {
+                    pos--;
+                }
+                while (pos && user_input[pos - 1] != ' ')
+                {
+                    pos--;
+                }
+                if (key == EDIT_KEY_WORD_LEFT)
+                {
+                    edit_move(pos);
+                }
+                else
+                {
+                    edit_delete(pos, edit_cursor - pos);
+                }
+                break;
+            case EDIT_KEY_WORD_RIGHT:
+                pos = edit_cursor;
+                while (pos < user_input_counter && user_input[pos] == ' ')
+                {
+                    pos++;
+                }
+                while (pos < user_input_counter && user_input[pos] != ' ')
+                {
+                    pos++;
+                }
+                edit_move(pos);
+                break;
+            case 11:  // Ctrl+K
+                pthread_mutex_lock(&prompt_lock);
+                user_input_counter = edit_cursor;
+                user_input[user_input_counter] = 0;
+                printf("\033[K");
+                fflush(stdout);
+                pthread_mutex_unlock(&prompt_lock);
+                break;
+            case 21:  // Ctrl+U
+                edit_delete(0, edit_cursor);
+                break;
+            case 16:  // Ctrl+P
+            case EDIT_KEY_UP:
+                if (history.browse > 0 && history.browse > history.count - HISTORY_MAX)
+                {
+                    if (history.browse == history.count)
+                    {
+                        free(history.draft);
+                        history.draft = strdup(user_input);  // back to it with down
+                    }
+                    history.browse--;
+                    edit_replace(history.lines[history.browse % HISTORY_MAX]);
+                }
+                break;
+            case 14:  // Ctrl+N
+            case EDIT_KEY_DOWN:
+                if (history.browse < history.count)
+                {
+                    history.browse++;
+                    edit_replace(history.browse == history.count ? (history.draft ? history.draft : "")
+                                                                 : history.lines[history.browse % HISTORY_MAX]);
+                }
+                break;
+            case '\t':
+                edit_complete();
+                break;
+            default:
+                if (key >= 32 && key < 256)
+                {
+                    char c = key;
+                    edit_insert(&c, 1);
+                }
+                break;  // other control characters are ignored
+        }
+    }
+}
+
+// Function to pass keystrokes to the UART until the escape key (char command)
+void char_mode(void)
+{
+    struct termios saved, raw;
+    char buf[BUF_SIZE];
+
+    if (tx_resume_running())  // keys would end up in the receiver file
+    {
+        printf("transfer of %s still running\n", tx.bulk_name);
+        return;
+    }
+
+    // every key to us: no line editing, no signals (Ctrl+C is for the target), no CR translation
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_iflag &= ~(ICRNL | INLCR | IGNCR | IXON | IXOFF | ISTRIP);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    printf("character mode, Ctrl+] returns to the prompt\n");
+    if (isatty(STDOUT_FILENO))
+    {
+        printf("\033[?2004l");  // pasted text goes to the target as it is
+    }
+    fflush(stdout);
+    __atomic_store_n(&charmode.active, 1, __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        int n;
+        if (input.pos < input.len)
+        {
+            n = input.len - input.pos < (int)sizeof(buf) ? input.len - input.pos : (int)sizeof(buf);
+            memcpy(buf, &input.data[input.pos], n);  // typed before the mode switched
+            input.pos += n;
+        }
+        else
+        {
+            n = read(STDIN_FILENO, buf, sizeof(buf));  // a key or a whole escape sequence
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        long long start = monotonic_us();
+        char *escape = memchr(buf, CHAR_ESCAPE, n);
+        if (escape)
+        {
+            n = escape - buf;
+        }
+        if (n)
+        {
+            write_uart_len(buf, n);  // not queued behind the tx scheduler
+            tcdrain(uart_fd);        // measure until the bytes left the UART
+            long long latency = monotonic_us() - start;
+            charmode.keys++;
+            charmode.bytes += n;
+            charmode.latency_sum_us += latency;
+            if (latency > charmode.latency_max_us)
+            {
+                charmode.latency_max_us = latency;
+            }
+        }
+        if (escape)
+        {
+            break;
+        }
+    }
+
+    __atomic_store_n(&charmode.active, 0, __ATOMIC_RELAXED);
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    if (isatty(STDOUT_FILENO))
+    {
+        printf("\033[?2004h");
+    }
+    printf("\nback to the prompt\n");
+}
+
+// Function to continuously prompt the user for input and send it over UART
+void* write_thread(void* arg) 
+{
+    input_reserve(BUF_SIZE);
+    if (user_input == NULL)
+    {
+        perror("Error allocating input line");
+        return NULL;
+    }
+    history_load();
+    while (1) 
+    {
+        // Display prompt for user input
+        printf(PROMPT);
+        fflush(stdout);
+
+        if (edit_line() != E_OK)
+        {
+            shutdown_request();  // stdin is gone
+            return NULL;
+        }
+        clear_prompt();  // Delete previous input
+        history_add(user_input);
+
+        if(strncmp(user_input,"R>>",3) == 0) // redirect recieved data to a resumable file
+        {
+            resume_receive_open((const char *)&(user_input[3]));
+        }
+        else if(strncmp(user_input,"T<<",3) == 0) // transmit file resuming from receiver checkpoint
+        {
+            resume_transmit((const char *)&(user_input[3]));
+        }
+        else if(strncmp(user_input,"R+",2) == 0) // also capture recieved data to file
+        {
+            int fd = open((const char *)&(user_input[2]), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+            if (fd == -1)
+            {
+                perror("Error opening capture file\n");
+            }
+            else if (rx_subscribe((const char *)&(user_input[2]), rx_capture_policy, fd, rx_capture) == NULL)
+            {
+                close(fd);
+            }
+            else
+            {
+                printf("Capture : %s added\n", &(user_input[2]));
+            }
+        }
+        else if(strncmp(user_input,"R-",2) == 0) // stop an additional capture
+        {
+            if (rx_unsubscribe((const char *)&(user_input[2])) == E_OK)
+            {
+                printf("Capture : %s removed\n", &(user_input[2]));
+            }
+            else
+            {
+                printf("Capture : %s not found\n", &(user_input[2]));
+            }
+        }
+        else if(strncmp(user_input,"R>",2) == 0) // redirect recieved data to file
+        {
+            if(strcmp((const char *)&(user_input[2]),"shell") == 0)
+            {
+                struct rx_sink *sink = rx_sink_new(OUT_FLAG_SHELL, -1, "shell");
+                if (sink)
+                {
+                    rx_sink_switch(sink);  // closes the previous file, keeps its checkpoint for a later R>>
+                    printf("Redirection : to shell\n");
+                }
+            }
+            else
+            {
+                // Open the file for writing (create if it doesn't exist, truncate if it exists)
+                int fd = open((const char *)&(user_input[2]), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+                struct rx_sink *sink = NULL;
+                if (fd == -1) 
+                {
+                    perror("Error opening destination file\n");
+                }
+                else if ((sink = rx_sink_new(OUT_FLAG_DEST, fd, (const char *)&(user_input[2]))) == NULL)
+                {
+                    close(fd);
+                }
+                else
+                {
+                    rx_sink_switch(sink);  // closes the previous file
+                    printf("Redirection : to %s\n",&(user_input[2]));
+                }
+            }
+        }
+        else if(strncmp(user_input,"T<",2) == 0) // redirect file to transmit
+        {
+                // Open the source file for reading
+                source_fd = open((const char *)&(user_input[2]), O_RDONLY);
+                if (source_fd == -1) 
+                {
+                    perror("Error opening source file\n");
+                }
+                else
+                {
+                    struct stat st;
+                    fstat(source_fd, &st);
+                    // the scheduler sends it in slices, the prompt stays usable meanwhile
+                    if (tx_submit_file(source_fd, (const char *)&(user_input[2]), 0, st.st_size) != E_OK)
+                    {
+                        close(source_fd);
+                    }
+                    else
+                    {
+                        printf("\033[0;31msent->\033[0mtransmitting %s (%lld bytes)\n", &(user_input[2]), (long long)st.st_size);
+                    }
+                }
+        }
+        else if(strcmp(user_input,"stats") == 0) // print runtime statistics
+        {
+            print_stats();
+        }
+        else if(strncmp(user_input,"search ",7) == 0) // latest scrollback line containing the text
+        {
+            scroll_search((const char *)&(user_input[7]), 0);
+        }
+        else if(strncmp(user_input,"grep ",5) == 0) // every scrollback line containing the text
+        {
+            scroll_search((const char *)&(user_input[5]), 1);
+        }
+        else if(strcmp(user_input,"char") == 0) // keystrokes straight to the target until Ctrl+]
+        {
+            char_mode();
+        }
+        else if(strcmp(user_input,"triggers") == 0) // list the triggers and their hits
+        {
+            print_triggers();
+        }
+        else if(strncmp(user_input,"dtr ",4) == 0) // dtr on|off|pulse <us>
+        {
+            modem_command(TIOCM_DTR, "DTR", (const char *)&(user_input[4]));
+        }
+        else if(strncmp(user_input,"rts ",4) == 0) // rts on|off|pulse <us>
+        {
+            modem_command(TIOCM_RTS, "RTS", (const char *)&(user_input[4]));
+        }
+        else if(strcmp(user_input,"modem") == 0) // state and changes of the modem lines
+        {
+            print_modem();
+        }
+        else if(strcmp(user_input,"rpc") == 0) // requests and latency histograms per command
+        {
+            print_rpc();
+        }
+        else if(strncmp(user_input,"rpc ",4) == 0) // send a command through the RPC layer
+        {
+            if (rpc_start() == E_OK)
+            {
+                rpc_call((const char *)&(user_input[4]), RPC_OWNER_SHELL);  // the answer is reported when it is complete
+            }
+        }
+        else if(strcmp(user_input,"bench") == 0 || strncmp(user_input,"bench ",6) == 0) // round trip time
+        {
+            bench_run(user_input[5] ? atoi((const char *)&(user_input[6])) : BENCH_COUNT);
+        }
+        else
+        {
+            printf("\033[0;31msent->\033[0m%s\n", user_input);  // Print the sent-> data
+            write_uart(user_input);  // Send the input data over UART
+        }
+
+        pthread_mutex_lock(&prompt_lock);
+        user_input_counter = 0;  // Reset the input counter
+        edit_cursor = edit_window = 0;
+        user_input[0] = 0;
+        pthread_mutex_unlock(&prompt_lock);
+    }
+    return E_OK;
+}
+
+// Function to ask the shutdown thread to end the program (stdin closed)
+void shutdown_request(void)
+{
+    unsigned long long one = 1;
+    if (write(shut.wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("Error requesting shutdown");
+    }
+}
+
+// Function to wait for SIGINT/SIGTERM or a shutdown request, then clean up
+void* shutdown_thread(void* arg)
+{
+    struct pollfd fds[2] = { { shut.signal_fd, POLLIN, 0 }, { shut.wake_fd, POLLIN, 0 } };
+
+    while (poll(fds, 2, -1) < 0 && errno == EINTR)
+    {
+    }
+    if (fds[0].revents & POLLIN)
+    {
+        struct signalfd_siginfo info;
+        if (read(shut.signal_fd, &info, sizeof(info)) == sizeof(info))
+        {
+            shut.signo = info.ssi_signo;
+        }
+    }
+    cleanup_and_exit();
+    return NULL;
+}
+
+// Function to name the first stage still holding data on its way out, NULL when all is delivered
+const char* shutdown_pending(void)
+{
+    const char *pending = NULL;
+    int queued = 0;
+
+    pthread_mutex_lock(&tx.lock);
+    if (tx.line_count || tx.sending || tx.bulk_fd >= 0)
+    {
+        pending = "tx queue";
+    }
+    pthread_mutex_unlock(&tx.lock);
+    if (pending == NULL && ioctl(uart_fd, TIOCOUTQ, &queued) == 0 && queued > 0)
+    {
+        pending = "uart output";  // sent bytes still in the driver
+    }
+
+    pthread_mutex_lock(&rx.lock);
+    for (int i = 0; i < RX_SUBSCRIBERS && pending == NULL; i++)
+    {
+        struct rx_subscriber *sub = &rx.subs[i];
+        if (sub->used && !sub->stop && (sub->cursor != rx.head || sub->busy))
+        {
+            pending = sub->name;  // received bytes not yet shown or written
+        }
+    }
+    pthread_mutex_unlock(&rx.lock);
+
+    if (pending == NULL && net_mode)
+    {
+        pthread_mutex_lock(&net.lock);
+        for (int i = 0; i < NET_CLIENTS && pending == NULL; i++)
+        {
+            if (net.clients[i].fd >= 0 && net.clients[i].out_len)
+            {
+                pending = "net clients";
+            }
+        }
+        pthread_mutex_unlock(&net.lock);
+    }
+    return pending;
+}
+
+// Function to deliver pending data until the drain deadline, sync the captures and exit
+void cleanup_and_exit() 
+{
+    long long start = monotonic_us();
+    long long deadline = start + (long long)shut.drain_ms * 1000;
+    FILE *out = (pipe_mode || script_file) ? stderr : stdout;  // stdout belongs to the pipeline there
+    const char *pending;
+
+    if (!pipe_mode && !script_file && !mux_mode && !net_mode)
+    {
+        clear_prompt();  // the last one, redraw_prompt() does nothing from here on
+    }
+    __atomic_store_n(&shut.stopping, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&tx.lock);
+    pthread_cond_signal(&tx.wake);  // stops the bulk transfer
+    pthread_mutex_unlock(&tx.lock);
+
+    // the threads keep running: queued lines go out, the subscribers write what was received
+    while ((pending = shutdown_pending()) != NULL && monotonic_us() < deadline)
+    {
+        usleep(1000);
+    }
+
+    if (pending == NULL)
+    {
+        // partial lines (a prompt of the target) are not waiting for their idle timeout
+        pthread_mutex_lock(&rx.lock);
+        for (int i = 0; i < RX_SUBSCRIBERS; i++)
+        {
+            struct rx_subscriber *sub = &rx.subs[i];
+            if (sub->used && sub->idle && sub->idle_armed && !sub->busy)
+            {
+                sub->idle_armed = 0;
+                pthread_mutex_unlock(&rx.lock);
+                sub->idle(sub);
+                pthread_mutex_lock(&rx.lock);
+            }
+        }
+        pthread_mutex_unlock(&rx.lock);
+
+        struct rx_sink *sink = __atomic_load_n(&port.sink, __ATOMIC_ACQUIRE);  // the reader is idle
+        if (sink && sink->kind == OUT_FLAG_RESUME && sink->resume.offset != sink->resume.ckpt_offset)
+        {
+            ckpt_save(sink);  // the bytes after the last full block count too
+        }
+    }
+
+    // captured bytes are on disk before we report
+    struct rx_sink *sink = __atomic_load_n(&port.sink, __ATOMIC_ACQUIRE);
+    if (sink && sink->fd >= 0)
+    {
+        fdatasync(sink->fd);
+    }
+    pthread_mutex_lock(&rx.lock);
+    for (int i = 0; i < RX_SUBSCRIBERS; i++)
+    {
+        if (rx.subs[i].used && rx.subs[i].fd >= 0)
+        {
+            fdatasync(rx.subs[i].fd);
+        }
+    }
+    pthread_mutex_unlock(&rx.lock);
+    link_low_latency_restore();
+    if (rpc.listen_fd >= 0)
+    {
+        unlink(rpc.socket_path);
+    }
+
+    if (shut.term_saved)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &shut.term);  // also leaves character mode
+        if (isatty(STDOUT_FILENO))
+        {
+            printf("\033[?2004l");
+        }
+    }
+
+    if (mux_mode)
+    {
+        for (int ch = 0; ch < MUX_CHANNELS; ch++)
+        {
+            printf("channel %s: %llu frames sent, %llu bytes received, %llu dropped\n",
+                   mux[ch].name, mux[ch].tx_frames, mux[ch].rx_bytes, mux[ch].rx_drops);
+        }
+    }
+
+    if (shut.signo)
+    {
+        fprintf(out, "%s, ", strsignal(shut.signo));
+    }
+    if (pending == NULL)
+    {
+        fprintf(out, "successfully terminated in %lld ms\n", (monotonic_us() - start) / 1000);
+    }
+    else
+    {
+        fprintf(out, "terminated after the %d ms drain deadline, %s still pending\n", shut.drain_ms, pending);
+    }
+    exit(E_OK);  // the file descriptors are closed by the kernel, the data is already out
 }